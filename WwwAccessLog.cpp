@@ -0,0 +1,167 @@
+#include <WwwAccessLog.h>
+
+WwwAccessLog::WwwAccessLog(void)
+{
+  _buffer = NULL;
+  _len = 0;
+  _tail = 0;
+  _used = 0;
+  _committed = 0;
+  _sectorSpace = WWW_ACCESS_LOG_SECTOR_SIZE;
+  _unflushed = 0;
+  _entryStarted = false;
+  _overflow = false;
+  _filenames[0] = NULL;
+  _filenames[1] = NULL;
+  _current = 0;
+  _maxSize = 0;
+}
+
+boolean WwwAccessLog::begin(char* buffer, int len, const char* filename1,
+			    const char* filename2, unsigned long maxSize)
+{
+  if (_file)
+    _file.close();
+  _buffer = NULL;
+
+  // Use a whole number of sectors, at least one
+  if (buffer == NULL || len < WWW_ACCESS_LOG_SECTOR_SIZE)
+    return false;
+  len -= len % WWW_ACCESS_LOG_SECTOR_SIZE;
+  _len = len;
+  _tail = 0;
+  _used = 0;
+  _committed = 0;
+  _entryStarted = false;
+  _filenames[0] = filename1;
+  _filenames[1] = filename2;
+  _maxSize = maxSize;
+
+  // Continue with the first file which is not full. If both are full
+  // start again with the first.
+  for (_current = 0; _current < 2; ++_current) {
+    File f = SD.open(_filenames[_current], FILE_READ);
+    if (!f)
+      break;
+    unsigned long size = f.size();
+    f.close();
+    if (size < _maxSize)
+      break;
+  }
+  if (_current == 2) {
+    _current = 0;
+    SD.remove(_filenames[_current]);
+  }
+
+  if (!openFile())
+    return false;
+  _buffer = buffer;
+  return true;
+}
+
+boolean WwwAccessLog::isEnabled(void) const
+{
+  return _buffer != NULL;
+}
+
+size_t WwwAccessLog::write(uint8_t c)
+{
+  if (!_entryStarted || _overflow)
+    return 0;
+  if (_used >= _len) {
+    _overflow = true;
+    return 0;
+  }
+  _buffer[(_tail + _used) % _len] = c;
+  ++_used;
+  return 1;
+}
+
+void WwwAccessLog::startEntry(void)
+{
+  if (_buffer == NULL)
+    return;
+  _used = _committed; // discard any unfinished entry
+  _entryStarted = true;
+  _overflow = false;
+}
+
+void WwwAccessLog::endEntry(void)
+{
+  if (!_entryStarted)
+    return;
+  if (_overflow)
+    _used = _committed;
+  else
+    _committed = _used;
+  _entryStarted = false;
+}
+
+boolean WwwAccessLog::isEntryStarted(void) const
+{
+  return _entryStarted;
+}
+
+boolean WwwAccessLog::isSectorReady(void) const
+{
+  return _committed >= _sectorSpace;
+}
+
+boolean WwwAccessLog::isNearlyFull(void) const
+{
+  return isSectorReady() && _len - _used < WWW_ACCESS_LOG_SECTOR_SIZE / 4;
+}
+
+boolean WwwAccessLog::writeSector(boolean force)
+{
+  if (_buffer == NULL || !_file)
+    return false;
+
+  uint16_t n = _committed;
+  if (n > _sectorSpace)
+    n = _sectorSpace;
+  if (n == 0 || (n < _sectorSpace && !force))
+    return false;
+
+  uint16_t first = _len - _tail;
+  if (first > n)
+    first = n;
+  _file.write((const uint8_t*)_buffer + _tail, first);
+  if (n > first)
+    _file.write((const uint8_t*)_buffer, n - first);
+
+  _tail = (_tail + n) % _len;
+  _used -= n;
+  _committed -= n;
+  _sectorSpace -= n;
+  if (_sectorSpace == 0) {
+    _sectorSpace = WWW_ACCESS_LOG_SECTOR_SIZE;
+    ++_unflushed;
+  }
+  if (_unflushed >= WWW_ACCESS_LOG_FLUSH_INTERVAL ||
+      (force && _committed == 0)) {
+    _file.flush();
+    _unflushed = 0;
+  }
+
+  if (_file.size() >= _maxSize) {
+    // Rotate
+    _file.close();
+    _current ^= 1;
+    SD.remove(_filenames[_current]);
+    openFile();
+  }
+  return true;
+}
+
+boolean WwwAccessLog::openFile(void)
+{
+  _file = SD.open(_filenames[_current], FILE_WRITE);
+  if (!_file)
+    return false;
+  // Appending continues part way through the last sector
+  _sectorSpace = WWW_ACCESS_LOG_SECTOR_SIZE -
+    _file.size() % WWW_ACCESS_LOG_SECTOR_SIZE;
+  _unflushed = 0;
+  return true;
+}
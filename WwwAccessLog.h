@@ -0,0 +1,69 @@
+#ifndef WWWACCESSLOG_H
+#define WWWACCESSLOG_H
+
+#define WWW_ACCESS_LOG_SECTOR_SIZE 512
+// Sectors written between flushes, which update the directory entry
+#define WWW_ACCESS_LOG_FLUSH_INTERVAL 8
+
+#include <SD.h>
+
+// Access log held in a RAM ring buffer and written to the SD card one
+// whole sector at a time. Entries are printed between startEntry() and
+// endEntry(); only complete entries are written to the card, and an
+// entry which does not fit in the buffer is dropped. Writes end on a
+// sector boundary of the file, even after a forced partial write, so
+// no sector is written twice.
+//
+// The SD library cannot rename files so rotation alternates between
+// two files: when the current file reaches its maximum size the other
+// is truncated and logging continues there.
+class WwwAccessLog : public Print
+{
+public:
+  WwwAccessLog(void);
+
+  // The buffer must be at least one sector long, and should be at
+  // least two so that new entries can be added whilst a sector is
+  // waiting to be written.
+  boolean begin(char* buffer, int len, const char* filename1,
+		const char* filename2, unsigned long maxSize);
+  boolean isEnabled(void) const;
+
+  virtual size_t write(uint8_t c);
+  using Print::write;
+
+  void startEntry(void);
+  void endEntry(void);
+  boolean isEntryStarted(void) const;
+
+  // True if complete entries fill the rest of a sector
+  boolean isSectorReady(void) const;
+  // True if a sector is ready and the buffer is nearly full, so it
+  // must be written soon
+  boolean isNearlyFull(void) const;
+
+  // Write one sector to the card. If force is true write complete
+  // entries up to the end of the sector even if they do not fill it,
+  // and flush the file once none are left.
+  boolean writeSector(boolean force = false);
+
+private:
+  boolean openFile(void);
+
+  char* _buffer;
+  uint16_t _len;
+  uint16_t _tail; // position of oldest unwritten byte
+  uint16_t _used; // bytes in buffer, including incomplete entry
+  uint16_t _committed; // bytes of complete entries
+  uint16_t _sectorSpace; // bytes to the next sector boundary of the file
+  uint8_t _unflushed; // sectors written since the last flush
+  boolean _entryStarted;
+  boolean _overflow; // current entry did not fit
+
+  const char* _filenames[2];
+  uint8_t _current; // index into _filenames
+  unsigned long _maxSize;
+  File _file;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef WWWCLOCK_H
+#define WWWCLOCK_H
+
+#include <Arduino.h>
+
+// Clocks used for all timing by the library. Define these (eg with -D
+// compiler flags, since the library is compiled separately from the
+// sketch) to run the server from another clock, such as a simulated
+// one which can be stepped past the 32-bit rollover. Readings are
+// held as uint32_t, so that differences between them wrap as the
+// clocks do even where unsigned long is wider.
+#ifndef WWW_SERVER_MICROS
+#define WWW_SERVER_MICROS() micros()
+#endif
+
+#ifndef WWW_SERVER_MILLIS
+#define WWW_SERVER_MILLIS() millis()
+#endif
+
+#endif
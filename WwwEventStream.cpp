@@ -0,0 +1,188 @@
+#include <WwwEventStream.h>
+
+WwwEventStream::WwwEventStream(void)
+{
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i)
+    _subscribers[i].used = false;
+  begin(NULL, 0);
+}
+
+void WwwEventStream::begin(char* buffer, int len)
+{
+  if (len <= 0)
+    buffer = NULL;
+  _buffer = buffer;
+  _len = (buffer ? len : 0);
+  _head = 0;
+  _tail = 0;
+  _next = 0;
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i)
+    _subscribers[i].position = 0;
+}
+
+boolean WwwEventStream::isEnabled(void) const
+{
+  return _buffer != NULL;
+}
+
+boolean WwwEventStream::publish(const char* data, const char* event)
+{
+  const char eventField[] = "event: ";
+  const char dataField[] = "data: ";
+  if (_buffer == NULL)
+    return false;
+
+  // Work out the size of the formatted event
+  unsigned long size = 1; // blank line which ends the event
+  if (event)
+    size += sizeof(eventField) - 1 + strlen(event) + 1;
+  const char *cp = data;
+  do {
+    const char *eol = strchr(cp, '\n');
+    int lineLen = (eol ? eol - cp : strlen(cp));
+    size += sizeof(dataField) - 1 + lineLen + 1;
+    cp += lineLen + (eol != NULL);
+  } while (*cp);
+  if (size > _len)
+    return false;
+
+  while (_head + size - _tail > _len)
+    dropOldestEvent();
+
+  if (event) {
+    put(eventField);
+    put(event);
+    put("\n");
+  }
+  cp = data;
+  do {
+    const char *eol = strchr(cp, '\n');
+    int lineLen = (eol ? eol - cp : strlen(cp));
+    put(dataField);
+    put(cp, lineLen);
+    put("\n");
+    cp += lineLen + (eol != NULL);
+  } while (*cp);
+  put("\n");
+  return true;
+}
+
+boolean WwwEventStream::canSubscribe(void) const
+{
+  if (_buffer == NULL)
+    return false;
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i)
+    if (!_subscribers[i].used)
+      return true;
+  return false;
+}
+
+// New subscribers receive events published from now on
+boolean WwwEventStream::subscribe(EthernetClient& client)
+{
+  if (_buffer == NULL)
+    return false;
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i) {
+    subscriber_t *sp = &_subscribers[i];
+    if (sp->used)
+      continue;
+    sp->client = client;
+    sp->position = _head;
+    sp->atEventStart = true;
+    sp->used = true;
+    return true;
+  }
+  return false;
+}
+
+uint8_t WwwEventStream::getSubscriberCount(void) const
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i)
+    n += _subscribers[i].used;
+  return n;
+}
+
+boolean WwwEventStream::isPending(void) const
+{
+  for (uint8_t i = 0; i < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++i)
+    if (_subscribers[i].used && _subscribers[i].position != _head)
+      return true;
+  return false;
+}
+
+boolean WwwEventStream::service(int len)
+{
+  for (uint8_t n = 0; n < WWW_EVENT_STREAM_MAX_SUBSCRIBERS; ++n) {
+    subscriber_t *sp = &_subscribers[_next];
+    if (++_next >= WWW_EVENT_STREAM_MAX_SUBSCRIBERS)
+      _next = 0;
+    if (!sp->used)
+      continue;
+
+    if (!sp->client.connected()) {
+      sp->client.stop();
+      sp->used = false;
+      return true;
+    }
+    if (sp->position == _head)
+      continue; // nothing to send
+
+    if ((long)(sp->position - _tail) < 0) {
+      // Data has been overwritten
+      if (!sp->atEventStart) {
+	sp->client.stop();
+	sp->used = false;
+	return true;
+      }
+      sp->position = _tail;
+    }
+
+    // Send as much as the client can accept without waiting, but
+    // don't wrap around the end of the buffer
+    unsigned long count = _head - sp->position;
+    uint16_t offset = sp->position % _len;
+    if (count > (unsigned long)(_len - offset))
+      count = _len - offset;
+    if (count > (unsigned long)len)
+      count = len;
+    int space = sp->client.availableForWrite();
+    if (space <= 0)
+      continue; // slow subscriber, try the next one
+    if (count > (unsigned long)space)
+      count = space;
+
+    sp->client.write((const uint8_t*)_buffer + offset, count);
+    sp->position += count;
+    sp->atEventStart = (byteAt(sp->position - 1) == '\n' &&
+			byteAt(sp->position - 2) == '\n');
+    return true;
+  }
+  return false;
+}
+
+char WwwEventStream::byteAt(unsigned long position) const
+{
+  return _buffer[position % _len];
+}
+
+void WwwEventStream::put(const char* s)
+{
+  put(s, strlen(s));
+}
+
+void WwwEventStream::put(const char* s, int len)
+{
+  while (len--)
+    _buffer[_head++ % _len] = *s++;
+}
+
+// Move the tail to the start of the next event. Events end with a
+// blank line, and no other blank lines are possible.
+void WwwEventStream::dropOldestEvent(void)
+{
+  ++_tail;
+  while ((long)(_head - _tail) > 0 &&
+	 !(byteAt(_tail - 1) == '\n' && byteAt(_tail - 2) == '\n'))
+    ++_tail;
+}
@@ -0,0 +1,61 @@
+#ifndef WWWEVENTSTREAM_H
+#define WWWEVENTSTREAM_H
+
+// Maximum number of clients receiving events at once
+#define WWW_EVENT_STREAM_MAX_SUBSCRIBERS 2
+
+#include <Ethernet.h>
+
+// Server-Sent Events (text/event-stream) broadcaster. Published events
+// are formatted once into a ring buffer supplied by the user; each
+// subscribed connection has its own read position in the buffer. No
+// call ever waits for a client: a subscriber which has fallen so far
+// behind that its unsent data has been overwritten skips ahead to the
+// oldest event still held, or is dropped if it was part way through
+// an event.
+//
+// Positions are counted in bytes since begin() so that they are
+// unaffected by wrapping around the buffer.
+class WwwEventStream
+{
+public:
+  WwwEventStream(void);
+
+  void begin(char* buffer, int len);
+  boolean isEnabled(void) const;
+
+  // Add an event. Each line of data is sent as a separate data
+  // field. Returns false if the event is too large for the buffer.
+  boolean publish(const char* data, const char* event = NULL);
+
+  boolean canSubscribe(void) const;
+  boolean subscribe(EthernetClient& client);
+  uint8_t getSubscriberCount(void) const;
+  boolean isPending(void) const;
+
+  // Send up to len bytes to the next subscriber with data
+  // waiting. Returns true if anything was done.
+  boolean service(int len);
+
+private:
+  typedef struct {
+    EthernetClient client;
+    unsigned long position;
+    boolean used;
+    boolean atEventStart;
+  } subscriber_t;
+
+  char byteAt(unsigned long position) const;
+  void put(const char* s);
+  void put(const char* s, int len);
+  void dropOldestEvent(void);
+
+  char* _buffer;
+  uint16_t _len;
+  unsigned long _head; // position for next byte
+  unsigned long _tail; // position of oldest event held
+  subscriber_t _subscribers[WWW_EVENT_STREAM_MAX_SUBSCRIBERS];
+  uint8_t _next; // subscriber to service next
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include <WwwFileCache.h>
+
+// Entries are kept aligned so that the header can be accessed
+// directly on processors which need aligned access.
+#define WWW_FILE_CACHE_ALIGN(n) (((n) + 1) & ~1)
+
+WwwFileCache::WwwFileCache(void)
+{
+  begin(NULL, 0);
+}
+
+void WwwFileCache::begin(char* arena, int len, uint16_t maxFileSize)
+{
+  if (arena && ((uintptr_t)arena & 1)) {
+    ++arena;
+    --len;
+  }
+  if (arena == NULL || len < (int)sizeof(entry_t)) {
+    arena = NULL;
+    len = 0;
+  }
+  _arena = arena;
+  _len = len;
+  _used = 0;
+  _maxFileSize = maxFileSize;
+  _clock = 0;
+}
+
+boolean WwwFileCache::isEnabled(void) const
+{
+  return _arena != NULL;
+}
+
+uint16_t WwwFileCache::getMaxFileSize(void) const
+{
+  return _maxFileSize;
+}
+
+int WwwFileCache::find(const char* url)
+{
+  int entry = 0;
+  while (entry < _used) {
+    entry_t* e = entryAt(entry);
+    if (!e->stale && e->filled == e->size &&
+	strcmp(getUrl(entry), url) == 0) {
+      e->lastUsed = ++_clock;
+      return entry;
+    }
+    entry += e->length;
+  }
+  return -1;
+}
+
+int WwwFileCache::create(const char* url, const char* mimeType,
+			 uint16_t size)
+{
+  if (_arena == NULL || size > _maxFileSize)
+    return -1;
+
+  int urlLen = strlen(url) + 1;
+  int mimeLen = strlen(mimeType) + 1;
+  unsigned long length =
+    WWW_FILE_CACHE_ALIGN(sizeof(entry_t) + urlLen + mimeLen +
+			 (unsigned long)size);
+  if (length > _len)
+    return -1;
+
+  invalidate(url); // never keep two copies
+  while (_used + length > _len)
+    removeEntry(findVictim());
+
+  int entry = _used;
+  entry_t* e = entryAt(entry);
+  e->length = length;
+  e->size = size;
+  e->filled = 0;
+  e->lastUsed = ++_clock;
+  e->stale = false;
+  char *p = (char*)(e + 1);
+  memcpy(p, url, urlLen);
+  memcpy(p + urlLen, mimeType, mimeLen);
+  _used += length;
+  return entry;
+}
+
+boolean WwwFileCache::append(const char* url, const char* data, int len)
+{
+  int entry = 0;
+  while (entry < _used) {
+    entry_t* e = entryAt(entry);
+    if (!e->stale && e->filled < e->size &&
+	strcmp(getUrl(entry), url) == 0) {
+      if (len > e->size - e->filled) {
+	// File has grown since the entry was made
+	e->stale = true;
+	return false;
+      }
+      memcpy((char*)getData(entry) + e->filled, data, len);
+      e->filled += len;
+      return true;
+    }
+    entry += e->length;
+  }
+  return false;
+}
+
+void WwwFileCache::invalidate(const char* url)
+{
+  int entry = 0;
+  while (entry < _used) {
+    entry_t* e = entryAt(entry);
+    if (strcmp(getUrl(entry), url) == 0)
+      e->stale = true;
+    entry += e->length;
+  }
+}
+
+void WwwFileCache::clear(void)
+{
+  int entry = 0;
+  while (entry < _used) {
+    entry_t* e = entryAt(entry);
+    e->stale = true;
+    entry += e->length;
+  }
+}
+
+const char* WwwFileCache::getMimeType(int entry) const
+{
+  const char* url = getUrl(entry);
+  return url + strlen(url) + 1;
+}
+
+const char* WwwFileCache::getData(int entry) const
+{
+  const char* mimeType = getMimeType(entry);
+  return mimeType + strlen(mimeType) + 1;
+}
+
+uint16_t WwwFileCache::getSize(int entry) const
+{
+  return entryAt(entry)->size;
+}
+
+WwwFileCache::entry_t* WwwFileCache::entryAt(int entry) const
+{
+  return (entry_t*)(_arena + entry);
+}
+
+const char* WwwFileCache::getUrl(int entry) const
+{
+  return (const char*)(entryAt(entry) + 1);
+}
+
+// Remove an entry and move all following entries down to fill the
+// gap.
+void WwwFileCache::removeEntry(int entry)
+{
+  uint16_t length = entryAt(entry)->length;
+  memmove(_arena + entry, _arena + entry + length,
+	  _used - (entry + length));
+  _used -= length;
+}
+
+// Choose which entry to remove. Stale or incomplete entries go first,
+// otherwise the least recently used.
+int WwwFileCache::findVictim(void) const
+{
+  int victim = 0;
+  uint16_t oldest = 0;
+  int entry = 0;
+  while (entry < _used) {
+    entry_t* e = entryAt(entry);
+    if (e->stale || e->filled < e->size)
+      return entry;
+    uint16_t age = _clock - e->lastUsed;
+    if (age >= oldest) {
+      oldest = age;
+      victim = entry;
+    }
+    entry += e->length;
+  }
+  return victim;
+}
@@ -0,0 +1,80 @@
+#ifndef WWWFILECACHE_H
+#define WWWFILECACHE_H
+
+// Default limit on the size of files which are cached in RAM
+#define WWW_FILE_CACHE_MAX_FILE_SIZE 1024
+// Set to 1 to compare the size of a cached file with the card before
+// serving it, so that a file changed by other code is not served
+// stale. This opens the file on every hit. SD has no modification
+// time, so a change which keeps the size still needs
+// WwwServer::fileModified(), which is otherwise how changes must be
+// reported.
+#define WWW_FILE_CACHE_CHECK_SIZE 0
+
+#include <Arduino.h>
+
+// Cache for small files held in a memory arena supplied by the
+// user. Each entry holds the URL, MIME type and contents of one
+// file. Entries are packed one after another at the start of the
+// arena; when space is needed the least recently used entries are
+// removed and the remaining entries moved down to close the
+// gap. Entry handles are therefore only valid until the next call to
+// create().
+class WwwFileCache
+{
+public:
+  WwwFileCache(void);
+
+  // Use len bytes at arena for the cache. Files larger than
+  // maxFileSize bytes are never cached. A NULL arena disables
+  // the cache.
+  void begin(char* arena, int len,
+	     uint16_t maxFileSize = WWW_FILE_CACHE_MAX_FILE_SIZE);
+  boolean isEnabled(void) const;
+  uint16_t getMaxFileSize(void) const;
+
+  // Return the handle for the complete entry matching url, or -1 if
+  // none.
+  int find(const char* url);
+
+  // Make a new, empty, entry for a file of the given size. Returns the
+  // handle, or -1 if the file cannot be cached.
+  int create(const char* url, const char* mimeType, uint16_t size);
+
+  // Add data to the incomplete entry for url. Returns false if the
+  // entry no longer exists or the data would overflow the entry.
+  boolean append(const char* url, const char* data, int len);
+
+  // Mark entries as stale. Stale entries are never found, and are
+  // the first to be removed when space is needed. Their contents
+  // remain intact until then, so a response already being sent from
+  // an entry can be completed.
+  void invalidate(const char* url);
+  void clear(void);
+
+  const char* getMimeType(int entry) const;
+  const char* getData(int entry) const;
+  uint16_t getSize(int entry) const;
+
+private:
+  typedef struct {
+    uint16_t length;   // total length of entry, including this header
+    uint16_t size;     // file size
+    uint16_t filled;   // number of bytes of file data stored
+    uint16_t lastUsed; // value of _clock when last used
+    uint8_t stale;
+  } entry_t;
+
+  entry_t* entryAt(int entry) const;
+  const char* getUrl(int entry) const;
+  void removeEntry(int entry);
+  int findVictim(void) const;
+
+  char* _arena;
+  uint16_t _len;
+  uint16_t _used;
+  uint16_t _maxFileSize;
+  uint16_t _clock; // incremented each time an entry is used
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include <WwwFollow.h>
+
+// Room for the chunk size line (up to 4 hex digits and CRLF) before
+// the data, and CRLF after it
+#define WWW_FOLLOW_CHUNK_HEADER_LEN 6
+#define WWW_FOLLOW_CHUNK_OVERHEAD (WWW_FOLLOW_CHUNK_HEADER_LEN + 2)
+
+WwwFollow::WwwFollow(void)
+{
+  for (uint8_t i = 0; i < WWW_FOLLOW_MAX_FOLLOWERS; ++i)
+    _followers[i].used = false;
+  _next = 0;
+  setTiming(WWW_FOLLOW_POLL_INTERVAL, WWW_FOLLOW_IDLE_TIMEOUT);
+}
+
+void WwwFollow::setTiming(unsigned long pollInterval,
+			  unsigned long idleTimeout)
+{
+  _pollInterval = pollInterval;
+  _idleTimeout = idleTimeout;
+}
+
+boolean WwwFollow::canFollow(const char* filename) const
+{
+  if (strlen(filename) > WWW_FOLLOW_MAX_FILENAME_LEN)
+    return false;
+  for (uint8_t i = 0; i < WWW_FOLLOW_MAX_FOLLOWERS; ++i)
+    if (!_followers[i].used)
+      return true;
+  return false;
+}
+
+boolean WwwFollow::follow(EthernetClient& client, const char* filename,
+			  unsigned long position)
+{
+  if (!canFollow(filename))
+    return false;
+  for (uint8_t i = 0; i < WWW_FOLLOW_MAX_FOLLOWERS; ++i) {
+    follower_t *fp = &_followers[i];
+    if (fp->used)
+      continue;
+    fp->client = client;
+    strcpy(fp->filename, filename);
+    fp->position = position;
+    fp->lastPoll = fp->lastData = WWW_SERVER_MILLIS();
+    fp->due = true; // send the existing data straight away
+    fp->used = true;
+    return true;
+  }
+  return false;
+}
+
+uint8_t WwwFollow::getFollowerCount(void) const
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < WWW_FOLLOW_MAX_FOLLOWERS; ++i)
+    n += _followers[i].used;
+  return n;
+}
+
+unsigned long WwwFollow::getWakeDelay(void) const
+{
+  uint32_t now = WWW_SERVER_MILLIS();
+  unsigned long delay = 0xFFFFFFFFUL;
+  for (uint8_t i = 0; i < WWW_FOLLOW_MAX_FOLLOWERS; ++i) {
+    const follower_t *fp = &_followers[i];
+    if (!fp->used)
+      continue;
+    if (isDue(fp, now))
+      return 0;
+    unsigned long d = _pollInterval - (now - fp->lastPoll);
+    if (d < delay)
+      delay = d;
+  }
+  if (delay > 0xFFFFFFFFUL / 1000)
+    return 0xFFFFFFFFUL;
+  return delay * 1000;
+}
+
+boolean WwwFollow::service(char* buffer, int len)
+{
+  uint32_t now = WWW_SERVER_MILLIS();
+  for (uint8_t n = 0; n < WWW_FOLLOW_MAX_FOLLOWERS; ++n) {
+    follower_t *fp = &_followers[_next];
+    if (++_next >= WWW_FOLLOW_MAX_FOLLOWERS)
+      _next = 0;
+    if (!fp->used)
+      continue;
+
+    if (!fp->client.connected()) {
+      end(fp, false);
+      return true;
+    }
+    if (!isDue(fp, now))
+      continue;
+    if (now - fp->lastData >= _idleTimeout) {
+      end(fp, true);
+      return true;
+    }
+    if (fp->client.availableForWrite() <= WWW_FOLLOW_CHUNK_OVERHEAD)
+      continue; // slow follower, try the next one
+
+    // Data may remain, so stay due until caught up
+    fp->due = sendNewData(fp, buffer, len);
+    if (fp->due)
+      fp->lastData = now;
+    fp->lastPoll = now;
+    return true;
+  }
+  return false;
+}
+
+boolean WwwFollow::isDue(const follower_t* fp, uint32_t now) const
+{
+  return fp->due || now - fp->lastPoll >= _pollInterval;
+}
+
+// Send one chunk of data added since the last check. Returns true if
+// any data was sent.
+boolean WwwFollow::sendNewData(follower_t* fp, char* buffer, int len)
+{
+  int space = fp->client.availableForWrite();
+  if (space > len)
+    space = len;
+  space -= WWW_FOLLOW_CHUNK_OVERHEAD;
+  if (space <= 0)
+    return false;
+
+  File file = SD.open(fp->filename, FILE_READ);
+  if (!file || file.size() < fp->position) {
+    // Removed or truncated, so the client's copy no longer matches
+    if (file)
+      file.close();
+    end(fp, true);
+    return false;
+  }
+
+  unsigned long count = file.size() - fp->position;
+  if (count == 0) {
+    file.close();
+    return false;
+  }
+  if (count > (unsigned long)space)
+    count = space;
+  if (count > 0xFFFF)
+    count = 0xFFFF;
+
+  char *data = buffer + WWW_FOLLOW_CHUNK_HEADER_LEN;
+  int bytesRead = 0;
+  if (file.seek(fp->position))
+    bytesRead = file.read(data, count);
+  file.close();
+  if (bytesRead <= 0) {
+    end(fp, true);
+    return false;
+  }
+
+  // Put the size line immediately before the data
+  char *p = data;
+  *--p = '\n';
+  *--p = '\r';
+  int n = bytesRead;
+  do {
+    *--p = "0123456789ABCDEF"[n & 0xF];
+    n >>= 4;
+  } while (n);
+  data[bytesRead] = '\r';
+  data[bytesRead + 1] = '\n';
+  fp->client.write((const uint8_t*)p, data + bytesRead + 2 - p);
+  fp->position += bytesRead;
+  return true;
+}
+
+void WwwFollow::end(follower_t* fp, boolean sendLastChunk)
+{
+  if (sendLastChunk)
+    fp->client.print("0\r\n\r\n");
+  fp->client.stop();
+  fp->used = false;
+}
@@ -0,0 +1,70 @@
+#ifndef WWWFOLLOW_H
+#define WWWFOLLOW_H
+
+// Maximum number of clients following files at once
+#define WWW_FOLLOW_MAX_FOLLOWERS 2
+
+// Longest path of a file which can be followed
+#define WWW_FOLLOW_MAX_FILENAME_LEN 40
+
+// Default interval (ms) between checks for new data
+#define WWW_FOLLOW_POLL_INTERVAL 1000UL
+
+// Default time (ms) without new data after which the response is
+// ended
+#define WWW_FOLLOW_IDLE_TIMEOUT 300000UL
+
+#include <SD.h>
+#include <Ethernet.h>
+#include <WwwClock.h>
+
+// Stream data appended to files, like "tail -f". Each follower is sent
+// the file from its starting position onwards, then new data as the
+// file grows, using chunked transfer encoding. The response is ended
+// when no new data has arrived for the idle timeout.
+//
+// The size of an open File is not updated when the file is written
+// through another File object, so the file is opened afresh each time
+// it is checked. No file is held open between checks.
+class WwwFollow
+{
+public:
+  WwwFollow(void);
+
+  void setTiming(unsigned long pollInterval, unsigned long idleTimeout);
+
+  boolean canFollow(const char* filename) const;
+  // Take over client, which must already have been sent the response
+  // headers
+  boolean follow(EthernetClient& client, const char* filename,
+		 unsigned long position);
+  uint8_t getFollowerCount(void) const;
+  // Time (us) until service() next has work to do
+  unsigned long getWakeDelay(void) const;
+
+  // Check the next follower which is due, sending up to len-8 bytes of
+  // new data using buffer. Returns true if anything was done.
+  boolean service(char* buffer, int len);
+
+private:
+  typedef struct {
+    EthernetClient client;
+    char filename[WWW_FOLLOW_MAX_FILENAME_LEN + 1];
+    unsigned long position;
+    uint32_t lastPoll; // ms
+    uint32_t lastData; // ms
+    boolean used;
+    boolean due; // check without waiting for the poll interval
+  } follower_t;
+
+  boolean isDue(const follower_t* fp, uint32_t now) const;
+  boolean sendNewData(follower_t* fp, char* buffer, int len);
+  void end(follower_t* fp, boolean sendLastChunk);
+
+  follower_t _followers[WWW_FOLLOW_MAX_FOLLOWERS];
+  uint8_t _next; // follower to service next
+  unsigned long _pollInterval;
+  unsigned long _idleTimeout;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <WwwInclude.h>
+
+// Room for the chunk size line (up to 4 hex digits and CRLF) before
+// the data, and CRLF after it
+#define WWW_INCLUDE_CHUNK_HEADER_LEN 6
+#define WWW_INCLUDE_CHUNK_OVERHEAD (WWW_INCLUDE_CHUNK_HEADER_LEN + 2)
+// The zero length chunk which ends the response
+#define WWW_INCLUDE_LAST_CHUNK "0\r\n\r\n"
+
+const char WwwInclude::markerStart[] = "<!--#var ";
+const char WwwInclude::markerEnd[] = "-->";
+
+WwwInclude::WwwInclude(void)
+{
+  for (uint8_t i = 0; i < WWW_INCLUDE_MAX_VARIABLES; ++i)
+    _names[i] = NULL;
+  _out = NULL;
+  _staging = NULL;
+  _stagingLen = 0;
+  _used = 0;
+  _space = 0;
+  start();
+}
+
+boolean WwwInclude::addVariable(const char* name, variable_t callback)
+{
+  for (uint8_t i = 0; i < WWW_INCLUDE_MAX_VARIABLES; ++i)
+    if (_names[i] == NULL || strcmp(_names[i], name) == 0) {
+      _names[i] = name;
+      _callbacks[i] = callback;
+      return true;
+    }
+  return false;
+}
+
+void WwwInclude::start(void)
+{
+  _markerLen = 0;
+  _nameLen = 0;
+  _endLen = 0;
+  _ended = false;
+  _count = 0;
+}
+
+boolean WwwInclude::isEnded(void) const
+{
+  return _ended;
+}
+
+unsigned long WwwInclude::getLength(void) const
+{
+  return _count;
+}
+
+int WwwInclude::process(Print& out, const char* data, int len,
+			char* staging, int stagingLen, int space,
+			boolean end)
+{
+  if (stagingLen <= WWW_INCLUDE_CHUNK_OVERHEAD)
+    return 0;
+  _out = &out;
+  _staging = staging;
+  _stagingLen = stagingLen;
+  _used = 0;
+  _space = space;
+
+  // Stop while there is still room for whatever the next character
+  // may write: a value, or a marker which turns out not to be one
+  int n = 0;
+  while (n < len) {
+    if (n && getRoom() < (_markerLen ? WWW_INCLUDE_MAX_VALUE_LEN : 1))
+      break;
+    filter(data[n++]);
+  }
+
+  if (end && n == len && getRoom() >= _markerLen) {
+    // Incomplete marker at the end of the template
+    for (uint8_t i = 0; i < _markerLen; ++i)
+      write(_marker[i]);
+    _markerLen = 0;
+    _ended = true;
+  }
+  writeChunk();
+  if (_ended)
+    out.print(WWW_INCLUDE_LAST_CHUNK);
+
+  _out = NULL;
+  _staging = NULL;
+  return n;
+}
+
+size_t WwwInclude::write(uint8_t c)
+{
+  if (_staging == NULL || getRoom() < 1)
+    return 0;
+  _staging[WWW_INCLUDE_CHUNK_HEADER_LEN + _used++] = c;
+  ++_count;
+  if (_used >= _stagingLen - WWW_INCLUDE_CHUNK_OVERHEAD)
+    writeChunk();
+  return 1;
+}
+
+void WwwInclude::filter(char c)
+{
+  const uint8_t startLen = sizeof(markerStart) - 1;
+
+  if (_markerLen < startLen) {
+    if (c == markerStart[_markerLen])
+      _marker[_markerLen++] = c;
+    else if (_markerLen)
+      abandonMarker(c);
+    else
+      write(c);
+    return;
+  }
+
+  if (_markerLen >= WWW_INCLUDE_MAX_MARKER_LEN) {
+    abandonMarker(c);
+    return;
+  }
+
+  // The name, optional spaces, then the end of the marker
+  if (_endLen == 0 && _nameLen == _markerLen - startLen &&
+      (isalnum(c) || c == '_'))
+    ++_nameLen;
+  else if (_endLen == 0 && _nameLen && c == ' ')
+    ;
+  else if (_nameLen && c == markerEnd[_endLen]) {
+    if (markerEnd[++_endLen] == '\0') {
+      callVariable();
+      return;
+    }
+  }
+  else {
+    abandonMarker(c);
+    return;
+  }
+  _marker[_markerLen++] = c;
+}
+
+// Not a marker after all, send what was held back
+void WwwInclude::abandonMarker(char c)
+{
+  for (uint8_t i = 0; i < _markerLen; ++i)
+    write(_marker[i]);
+  _markerLen = 0;
+  _nameLen = 0;
+  _endLen = 0;
+  // c may start a new marker
+  filter(c);
+}
+
+void WwwInclude::callVariable(void)
+{
+  char *name = _marker + sizeof(markerStart) - 1;
+  name[_nameLen] = '\0';
+  _markerLen = 0;
+  _nameLen = 0;
+  _endLen = 0;
+  // Unknown variables are replaced by nothing
+  for (uint8_t i = 0; i < WWW_INCLUDE_MAX_VARIABLES && _names[i]; ++i)
+    if (strcmp(_names[i], name) == 0) {
+      (*_callbacks[i])(*this);
+      break;
+    }
+}
+
+void WwwInclude::writeChunk(void)
+{
+  if (_used == 0 || _out == NULL)
+    return;
+
+  // Put the size line immediately before the data
+  char *p = _staging + WWW_INCLUDE_CHUNK_HEADER_LEN;
+  *--p = '\n';
+  *--p = '\r';
+  int n = _used;
+  do {
+    *--p = "0123456789ABCDEF"[n & 0xF];
+    n >>= 4;
+  } while (n);
+  _staging[WWW_INCLUDE_CHUNK_HEADER_LEN + _used] = '\r';
+  _staging[WWW_INCLUDE_CHUNK_HEADER_LEN + _used + 1] = '\n';
+  int chunkLen = _staging + WWW_INCLUDE_CHUNK_HEADER_LEN + _used + 2 - p;
+  _out->write((const uint8_t*)p, chunkLen);
+  _space -= chunkLen;
+  _used = 0;
+}
+
+// Bytes which may be added to the current chunk, keeping back room for
+// its framing and the end of the response
+int WwwInclude::getRoom(void) const
+{
+  return _space - _used - WWW_INCLUDE_CHUNK_OVERHEAD -
+    (int)(sizeof(WWW_INCLUDE_LAST_CHUNK) - 1);
+}
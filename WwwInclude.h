@@ -0,0 +1,83 @@
+#ifndef WWWINCLUDE_H
+#define WWWINCLUDE_H
+
+// Maximum number of variables which can be registered
+#define WWW_INCLUDE_MAX_VARIABLES 8
+
+// Longest marker recognised, including "<!--#var " and "-->"
+#define WWW_INCLUDE_MAX_MARKER_LEN 32
+
+// Variable values up to this length are always sent whole; a longer
+// one is cut short if the output has no room for the rest. Must be
+// more than WWW_INCLUDE_MAX_MARKER_LEN.
+#define WWW_INCLUDE_MAX_VALUE_LEN 48
+
+#include <Arduino.h>
+
+// Server-side include filter. Template data is passed through in
+// pieces of any size; markers of the form <!--#var name--> are
+// replaced by whatever the callback registered for name prints. A
+// marker split across two pieces is held back until it is complete.
+//
+// Output is sent with chunked transfer encoding. Each chunk is built
+// in a staging buffer, together with its size line and trailing CRLF,
+// so that it reaches the client in a single write. The output of each
+// call is limited, however long the values; template which would not
+// fit is left to be passed again.
+class WwwInclude : public Print
+{
+public:
+  typedef void (*variable_t)(Print& out);
+
+  WwwInclude(void);
+
+  // name must remain valid whilst the filter is in use
+  boolean addVariable(const char* name, variable_t callback);
+
+  // Prepare for a new response
+  void start(void);
+
+  // Filter up to len bytes of template, writing no more than space
+  // bytes to out. staging is used to build chunks and must be more
+  // than 8 bytes long. Set end true when data holds the rest of the
+  // template; the response ends once all of it has been used. Returns
+  // the number of template bytes used, at least one if len > 0.
+  int process(Print& out, const char* data, int len, char* staging,
+	      int stagingLen, int space, boolean end);
+  boolean isEnded(void) const;
+  // Body bytes sent since start()
+  unsigned long getLength(void) const;
+
+  virtual size_t write(uint8_t c);
+  using Print::write;
+
+private:
+  void filter(char c);
+  void abandonMarker(char c);
+  void callVariable(void);
+  void writeChunk(void);
+  int getRoom(void) const;
+
+  static const char markerStart[];
+  static const char markerEnd[];
+
+  const char* _names[WWW_INCLUDE_MAX_VARIABLES];
+  variable_t _callbacks[WWW_INCLUDE_MAX_VARIABLES];
+
+  // Partial marker held back from the output
+  char _marker[WWW_INCLUDE_MAX_MARKER_LEN];
+  uint8_t _markerLen;
+  uint8_t _nameLen;
+  uint8_t _endLen; // characters of markerEnd matched
+  boolean _ended;
+
+  // Only valid during process()
+  Print* _out;
+  char* _staging;
+  int _stagingLen;
+  int _used;
+  int _space; // bytes which may still be written to _out
+  unsigned long _count;
+};
+
+#endif
@@ -1,10 +1,68 @@
 //#define __STDC_LIMIT_MACROS
 //#include <stdint.h>
-#include <avr/pgmspace.h>
-
 #include <limits.h>
 #include <WwwServer.h>
 
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+
+#if WWW_SERVER_MEMORY_STATS > 0
+extern char __heap_start;
+extern char *__brkval;
+
+#define WWW_SERVER_STACK_PAINT 0xA5
+// Distance below the lowest address found so far at which the search
+// for the stack's use starts
+#define WWW_SERVER_STACK_GUARD 32
+
+// Lowest address painted; memory freed from the heap below it since
+// holds old data and is painted before measuring
+static char* paintedFrom;
+// Lowest address found written since the stack was painted
+static char* lowWater;
+
+static char* heapEnd(void)
+{
+  return (__brkval ? __brkval : &__heap_start);
+}
+
+// Fill the memory between the heap and the stack with a known value
+static void __attribute__((noinline)) paintStack(void)
+{
+  paintedFrom = heapEnd();
+  lowWater = (char*)SP;
+  for (char *p = paintedFrom; p < lowWater; ++p)
+    *p = WWW_SERVER_STACK_PAINT;
+}
+
+// Return the lowest address written below the stack since the last
+// call, and paint what was used again. The search is upwards, so that
+// painted values left in stack frames (eg parts of unused buffers)
+// cannot end it early. It starts WWW_SERVER_STACK_GUARD bytes below
+// the low water mark; only a call which wrote there too has the whole
+// area from the heap searched. Interrupts may write below the stack
+// at any time, but only whilst they run.
+static char* __attribute__((noinline)) measureStack(void)
+{
+  char *sp = (char*)SP;
+  char *end = heapEnd();
+  for (char *p = end; p < paintedFrom; ++p)
+    *p = WWW_SERVER_STACK_PAINT;
+  paintedFrom = end;
+
+  char *lowest = lowWater - WWW_SERVER_STACK_GUARD;
+  if (lowest < end || (uint8_t)*lowest != WWW_SERVER_STACK_PAINT)
+    lowest = end;
+  while (lowest < sp && (uint8_t)*lowest == WWW_SERVER_STACK_PAINT)
+    ++lowest;
+  if (lowest < lowWater)
+    lowWater = lowest;
+  for (char *p = lowest; p < sp; ++p)
+    *p = WWW_SERVER_STACK_PAINT;
+  return lowest;
+}
+#endif
+
 // Uncomment to get debug messages printed to Serial
 // #define DEBUG
 
@@ -18,11 +76,17 @@ char WwwServer::htmlToTitle[] = {"<html><head><title>"};
 char WwwServer::titleToH1[] = {"</title></head>\n<body><h1>"};
 char WwwServer::closeH1[] = {"</h1>"};
 char WwwServer::closeBodyHtml[] = {"</body></html>"};
+const char WwwServer::serviceUnavailable[] = {
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: " WWW_SERVER_RETRY_AFTER "\r\n"
+  "Content-Length: 0\r\n"
+  "Connection: close\r\n\r\n"
+};
 
 const char* WwwServer::methodNames[] = {
   "HEAD",
   "GET",
-  // "POST",
+  "POST",
   "PUT",
   "DELETE",
   NULL
@@ -30,7 +94,7 @@ const char* WwwServer::methodNames[] = {
 
 const char* WwwServer::responseText[] = {
   "200 OK",
-  //"201 Created",
+  "201 Created",
   "301 Moved Permanently",
   "307 Temporary Redirect",
   "400 Bad Request",
@@ -39,12 +103,15 @@ const char* WwwServer::responseText[] = {
   "404 Not Found",
   "414 Request-URI Too Long",
   "500 Internal Server Error",
+  "429 Too Many Requests",
+  "503 Service Unavailable",
+  "408 Request Timeout",
   NULL
 };
 
 const char* WwwServer::errorDocumentKeys[] = {
   "error document 200",
-  //"error document 201",
+  "error document 201",
   "error document 301",
   "error document 307",
   "error document 400",
@@ -53,6 +120,9 @@ const char* WwwServer::errorDocumentKeys[] = {
   "error document 404",
   "error document 414",
   "error document 500",
+  "error document 429",
+  "error document 503",
+  "error document 408",
   NULL
 };
 
@@ -63,10 +133,31 @@ const char* WwwServer::handlerNames[] = {
   "temporary redirect",
   "status",
   "cgi",
+  "event stream",
+  "include",
+  "time range",
   NULL, // "directory listing", NULL ensures internal use only
   NULL
 };
 
+const char* WwwServer::priorityNames[] = {
+  "low",
+  "normal",
+  "high",
+  NULL
+};
+
+// Cache-Control directives which may be set in the ini file. Bit n
+// of policy_t::cacheDirectives selects entry n.
+const char* WwwServer::cacheDirectiveNames[] = {
+  "no-store",
+  "no-cache",
+  "private",
+  "public",
+  "must-revalidate",
+  "immutable",
+  NULL
+};
 
 // Static member function to decode a base64 string. A return value of
 // true indicates successful decoding.
@@ -82,9 +173,9 @@ boolean WwwServer::b64_decode(unsigned char* buffer, int len)
   //
 
   if (len  < 4)
-    // too short to be valid, and too short to terminate with null 
+    // too short to be valid, and too short to terminate with null
     return false;
-    
+
   int i = 0; // position counter
   const unsigned char* inp = buffer;
   unsigned char* outp = buffer;
@@ -92,7 +183,7 @@ boolean WwwServer::b64_decode(unsigned char* buffer, int len)
   while (*inp != '\0' && *inp != '=' && i <= len) {
     unsigned char val;
     c = *inp;
-    
+
     // Map to integer value for character
     if (c >= 'A' && c <= 'Z')
       val = (c - 'A');
@@ -112,7 +203,7 @@ boolean WwwServer::b64_decode(unsigned char* buffer, int len)
 	// Illegal character
 	return false;
       }
-    
+
     switch (i % 4) {
     case 0:
       *outp = val << 2;
@@ -137,16 +228,66 @@ boolean WwwServer::b64_decode(unsigned char* buffer, int len)
 }
 
 
+uint32_t WwwServer::hash(const char* s)
+{
+  uint32_t h = FNV_OFFSET_BASIS;
+  while (*s) {
+    h ^= (uint8_t)*s++;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+
 WwwServer::WwwServer(const char* filename, uint16_t port) \
-  : _port(port), _ini(filename), _server(port) 
+  : _port(port), _ownConfig(filename), _config(&_ownConfig), _server(port)
+{
+  init();
+}
+
+WwwServer::WwwServer(WwwServerConfig& config, uint16_t port) \
+  : _port(port), _ownConfig(NULL), _config(&config), _server(port)
+{
+  init();
+}
+
+void WwwServer::init(void)
 {
   //_port = port;
+  _urlPrefix = NULL;
+  _maxConcurrent = 0;
+  _maxQueued = 0;
+  _rateInterval = 0;
+  _rateBurst = 1;
+  _lastAdmissionPoll = 0;
+  _idlePollInterval = WWW_SERVER_IDLE_POLL_INTERVAL;
+  _lastIdlePoll = 0;
+  _requestStarted = 0;
+  _timeSource = NULL;
+  setTimeouts(WWW_SERVER_REQUEST_LINE_TIMEOUT, WWW_SERVER_HEADERS_TIMEOUT,
+	      WWW_SERVER_REQUEST_TIMEOUT, WWW_SERVER_TX_TIMEOUT);
+  setQueryBuffer(NULL, 0);
+#if WWW_SERVER_MAX_QUEUED > 0
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i)
+    _queue[i].used = false;
+#endif
+#if WWW_SERVER_RATE_LIMIT_CLIENTS > 0
+  for (uint8_t i = 0; i < WWW_SERVER_RATE_LIMIT_CLIENTS; ++i)
+    _rateLimits[i].address = 0;
+#endif
+
+#if WWW_SERVER_MEMORY_STATS > 0
+  for (uint8_t i = 0; i <= stateDisconnecting; ++i) {
+    _memoryUse[i].stackUsed = 0;
+    _memoryUse[i].memoryFree = 0xFFFF;
+  }
+#endif
+  memset(&_stats, 0, sizeof(_stats));
+  _statsSequence = 0;
+  _statsWindow = 0;
+  resetStats();
 
-  _stats.requestStarted = 0UL;
-  _stats.requestCount = 0UL;
-  _stats.requestTimeWorstCase = 0UL;
-  _stats.taskTimeWorstCase = 0UL;
-  _stats.taskWorstCaseState = -1;
+  _fileHash = 0;
 
   // Ensure clean starting point
   disconnect();
@@ -154,29 +295,189 @@ WwwServer::WwwServer(const char* filename, uint16_t port) \
 
 boolean WwwServer::begin(char *buffer, int len)
 {
-  // Check IniFile can be opened and validates
-  if (!_ini.open())
-    return false;
+  // Only the first server to start reads the ini file
+  if (!_config->isLoaded()) {
+    // Check IniFile can be opened and validates
+    if (!_config->_ini.open())
+      return false;
+
+    if (!_config->_ini.validate(buffer, len))
+      return false;
+
+    if (!loadPolicies(buffer, len))
+      return false;
+    _config->_loaded = true;
+  }
 
-  if (!_ini.validate(buffer, len))
-    return false;
-  
   // _ini.close();
   _server.begin();
+#if WWW_SERVER_MEMORY_STATS > 0
+  paintStack();
+#endif
   return true;
 }
 
+void WwwServer::setUrlPrefix(const char* prefix)
+{
+  _urlPrefix = prefix;
+}
+
+// Check _url against the prefix set by setUrlPrefix(). The prefix
+// must match whole path segments.
+boolean WwwServer::isUrlAllowed(void) const
+{
+  if (_urlPrefix == NULL)
+    return true;
+  int n = strlen(_urlPrefix);
+  if (strncmp(_url, _urlPrefix, n) != 0)
+    return false;
+  return (n && _urlPrefix[n-1] == '/') || _url[n] == '\0' || _url[n] == '/';
+}
+
+void WwwServer::setFileCache(char* arena, int len, uint16_t maxFileSize)
+{
+  _config->setFileCache(arena, len, maxFileSize);
+}
+
+void WwwServer::fileModified(const char* filename)
+{
+  _config->fileModified(filename);
+}
+
+void WwwServer::mediaChanged(void)
+{
+  _config->mediaChanged();
+}
+
+void WwwServer::setAdmissionPolicy(uint8_t maxConcurrent, uint8_t maxQueued)
+{
+  _maxConcurrent = maxConcurrent;
+  _maxQueued = maxQueued;
+}
+
+void WwwServer::setRateLimit(uint16_t requestsPerMinute, uint8_t burst)
+{
+  _rateInterval = (requestsPerMinute == 0 ? 0 :
+		   requestsPerMinute > 60000U ? 1 : 60000U / requestsPerMinute);
+  _rateBurst = (burst ? burst : 1);
+}
+
+boolean WwwServer::setAccessLog(char* buffer, int len,
+				const char* filename1, const char* filename2,
+				unsigned long maxSize)
+{
+  return _accessLog.begin(buffer, len, filename1, filename2, maxSize);
+}
+
+void WwwServer::flushAccessLog(void)
+{
+  while (_accessLog.writeSector(true))
+    ;
+}
+
+void WwwServer::setTimeSource(unsigned long (*timeSource)(void))
+{
+  _timeSource = timeSource;
+}
+
+void WwwServer::setEventBuffer(char* buffer, int len)
+{
+  _eventStream.begin(buffer, len);
+}
+
+boolean WwwServer::publishEvent(const char* data, const char* event)
+{
+  return _eventStream.publish(data, event);
+}
+
+void WwwServer::setFollowTiming(unsigned long pollInterval,
+				unsigned long idleTimeout)
+{
+  _follow.setTiming(pollInterval, idleTimeout);
+}
+
+boolean WwwServer::addIncludeVariable(const char* name,
+				   void (*callback)(Print& out))
+{
+  return _include.addVariable(name, callback);
+}
+
+void WwwServer::setUploadBuffer(char* buffer, int len)
+{
+  _upload.begin(buffer, len);
+}
+
+void WwwServer::setFormFieldCallback(void (*callback)(const char* name,
+						      const char* value))
+{
+  _upload.setFieldCallback(callback);
+}
+
+void WwwServer::setQueryBuffer(char* buffer, int len)
+{
+  if (buffer == NULL || len < 1) {
+    buffer = _queryString;
+    len = sizeof(_queryString);
+  }
+  _query = buffer;
+  _queryLen = len;
+  _query[0] = '\0';
+  _queryEnd = -1;
+}
+
+int WwwServer::nextQueryParameter(int pos, const char*& key,
+				  const char*& value)
+{
+  decodeQuery();
+  if (pos >= _queryEnd)
+    return 0;
+  key = _query + pos;
+  pos += strlen(key) + 1;
+  value = _query + pos;
+  pos += strlen(value) + 1;
+  return pos;
+}
+
+const char* WwwServer::getQueryValue(const char* key)
+{
+  const char *k, *v;
+  int pos = 0;
+  while ((pos = nextQueryParameter(pos, k, v)) != 0)
+    if (strcmp(k, key) == 0)
+      return v;
+  return NULL;
+}
+
 void WwwServer::disconnect(void)
 {
   if (_client)
     _client.stop();
-  if (_file)
+  _upload.abort(); // remove any partly received file
+  if (_file && !releasePooledFile())
     _file.close();
+  _fileHash = 0;
   _state = stateNoClient;
   _stateData = 0;
   _method = -1;
   _url[0] = '\0';
-  _queryString[0] = '\0';
+  _urlHash = 0;
+  _query[0] = '\0';
+  _queryEnd = -1;
+  _cacheEntry = -1;
+  _fillingCache = false;
+  _following = false;
+  _txWaiting = false;
+  _responseEndKnown = false;
+  _usPerByte = 0;
+  _timeRangeStarted = false;
+  _timeRangeFound = false;
+  _includeStarted = false;
+  _bytesSent = 0;
+  _linePart = partMethod;
+  _lineLen = 0;
+  _line[0] = '\0';
+  _skipLF = false;
+  _headersRead = false;
   _handler = handlerDefault;
   _statusCode = statusOK;
   _isAuthenticated = false;
@@ -185,28 +486,61 @@ void WwwServer::disconnect(void)
   _iniState = IniFileState();
 }
 
-// Return number of characters, or negative if an error
-int WwwServer::readLineFromClient(char* buffer, int len)
+// Add the characters of a header line which have arrived to buffer,
+// which must not be changed until the line is complete. Characters
+// which do not fit are discarded. Returns the length of the line once
+// its end has arrived, otherwise -1.
+int WwwServer::readHeaderLine(char* buffer, int len)
+{
+  while (_client.available()) {
+    char c = _client.read();
+    if (c == '\n' && _skipLF) {
+      _skipLF = false;
+      continue;
+    }
+    _skipLF = false;
+    if (c == '\r' || c == '\n') {
+      // The '\n' of a CRLF may not have arrived yet
+      _skipLF = (c == '\r');
+      int n = _lineLen;
+      _lineLen = 0;
+      return n;
+    }
+    if (_lineLen < len - 1) {
+      buffer[_lineLen++] = c;
+      buffer[_lineLen] = '\0';
+    }
+  }
+  if (!_client.connected()) {
+    // Nothing more will arrive; a later call returns an empty line
+    int n = _lineLen;
+    _lineLen = 0;
+    return n;
+  }
+  return -1;
+}
+
+int WwwServer::readLine(Stream& stream, char* buffer, int len)
 {
   int i = 0;
   char c;
   if (len < 3)
     return errorBufferTooShort;
-  
-  while (_client.connected() && _client.available()) {
-    c = _client.read();
+
+  while (stream.available()) {
+    c = stream.read();
     if (c == '\n') {
       // end of line discard any following '\r'
-      if (_client.peek() == '\r')
-	_client.read();
+      if (stream.peek() == '\r')
+	stream.read();
       buffer[i] = '\0';
       return i;
     }
 
     if (c == '\r') {
       // end of line discard any following '\n'
-      if (_client.peek() == '\n')
-	_client.read();
+      if (stream.peek() == '\n')
+	stream.read();
       buffer[i] = '\0';
       return i;
     }
@@ -228,7 +562,7 @@ int WwwServer::readLineFromClient(char* buffer, int len)
 int8_t WwwServer::processRequest(char* buffer, int len)
 {
   int i = 0;
-  unsigned long startMicros = micros();
+  uint32_t startMicros = WWW_SERVER_MICROS();
   uint8_t initialState = _state;
   if (len < 1) {
     i = errorBufferTooShort;
@@ -240,29 +574,61 @@ int8_t WwwServer::processRequest(char* buffer, int len)
   if (_state != stateNoClient && !_client) {
     _state = stateDisconnecting;
   }
-  
+
+  if (_state != stateNoClient)
+    checkTimeouts(startMicros);
+
+  // Deal with connections arriving whilst busy
+  if (_state != stateNoClient && _maxConcurrent && len > 0)
+    admitWaitingClient(buffer, len);
+
+  // The access log is normally written when idle, but must not be
+  // allowed to fill up
+  if (_state != stateNoClient && _accessLog.isNearlyFull())
+    _accessLog.writeSector();
+
   switch (_state) {
   case stateNoClient:
+    // Write the access log whilst there is nothing else to do
+    if (_accessLog.isSectorReady() && getConnectionCount() == 0) {
+      _accessLog.writeSector();
+      break;
+    }
+
+    // Connections which arrived whilst busy take precedence
+    if (takeQueuedClient(buffer, len))
+      break;
+
     // check if a new client is waiting
+    if (_idlePollInterval) {
+      if (startMicros - _lastIdlePoll < _idlePollInterval)
+	break;
+      _lastIdlePoll = startMicros;
+    }
     _client = _server.available();
-    if (!_client) 
+    if (!_client)
+      break;
+
+    // Denied hosts are dropped without using up any rate limit
+    if (!checkHostAllowed(_client)) {
+      _client = EthernetClient();
+      break;
+    }
+
+    if (checkRateLimit(_client)) {
+      _statusCode = statusTooManyRequests;
+      logRequestStart(false);
+      _state = stateClosingConnection;
       break;
-    
-    // TO DO: Check if client is allowed access
+    }
+    _requestStarted = startMicros;
     _state = stateReadingMethod;
     break;
-    
+
   case stateReadingMethod:
-    i = parseMethodUrlQueryString(buffer, len);
-    if (i < 0) {
-      if (i == errorRequestUriTooLong)
-	_statusCode = statusRequestUriTooLong;
-      else
-	_statusCode = statusBadRequest;
-      _state = stateSendingStatusCode;
-      break;
-    }
-    _state = stateGettingHandlerSetUp;
+    // Wait for the whole request line, checkTimeouts() limits how long
+    if ((i = readRequestLine()) != 0)
+      startRequest(i > 0 ? (int8_t)errorNoError : i);
     break;
 
   case stateGettingHandlerSetUp:
@@ -272,16 +638,25 @@ int8_t WwwServer::processRequest(char* buffer, int len)
     _lastSlash = NULL;
     _state = stateGettingHandler;
     break;
-    
+
   case stateGettingHandler:
     // Figure out how to process this request. Send file, an error
     // document, redirect etc
-    
+
     if (setHandler(buffer, len) == 0)
       break; // Not completed yet
     switch (_handler) {
     case handlerDefault:
-      _state = stateReadingHeaders;
+    case handlerStatus:
+    case handlerEventStream:
+    case handlerInclude:
+    case handlerTimeRange:
+      // Uploads are the only POST requests accepted, and only where
+      // the ini file allows them
+      if (_method == methodPost)
+	_state = stateCheckingPostSetUp;
+      else
+	_state = stateReadingHeaders;
       break;
     case handlerMovedPermanently:
       _statusCode = statusMovedPermanently;
@@ -299,32 +674,97 @@ int8_t WwwServer::processRequest(char* buffer, int len)
     }
     break;
 
+  case stateCheckingPostSetUp:
+    // Reset the variables which hold state information for
+    // getIniFileValueForUrl()
+    _iniState = IniFileState();
+    _lastSlash = NULL;
+    _upload.reset();
+    _state = stateCheckingPost;
+
+  case stateCheckingPost:
+    switch (checkPostAllowed(buffer, len)) {
+    case 0:
+      break; // Not completed yet
+    case 1:
+      _state = stateReadingHeaders;
+      break;
+    default:
+      _statusCode = statusForbidden;
+      _state = stateFindingErrorDocumentSetUp;
+      break;
+    }
+    break;
+
   case stateReadingHeaders:
-    // Parse the request headers, silently accept truncated ones
-    i = readLineFromClient(buffer, len);
+    // Parse the request headers, silently accept truncated ones. An
+    // upload may have a Content-Type line longer than _line.
+    if (_method == methodPost && _statusCode == statusOK &&
+	_upload.isEnabled()) {
+      char *uploadBuffer = _upload.getHeaderBuffer(i);
+      i = readHeaderLine(uploadBuffer, i);
+      if (i > 0)
+	parseHeader(uploadBuffer);
+    }
+    else {
+      i = readHeaderLine(_line, sizeof(_line));
+      if (i > 0)
+	parseHeader(_line);
+    }
 
     if (i == 0) {
-      // TO DO: will depend upon handler
-      _state = stateUrlToFilename;
-      break; // Empty line, stop processing headers
+      // Empty line, stop processing headers
+      _headersRead = true;
+      if (_handler == handlerEventStream && !_eventStream.canSubscribe()) {
+	_statusCode = statusServiceUnavailable;
+	_handler = handlerDefault;
+	_url[0] = '\0';
+      }
+      if (_handler == handlerDefault && _method == methodGet &&
+	  _statusCode == statusOK && getQueryValue("follow")) {
+	if (_follow.canFollow(_url))
+	  _following = true;
+	else {
+	  _statusCode = statusServiceUnavailable;
+	  _url[0] = '\0';
+	}
+      }
+
+      if (_method == methodPost && _statusCode == statusOK) {
+	if (_upload.isReady()) {
+	  // The response is the status code, whatever the handler
+	  _handler = handlerDefault;
+	  _upload.start(*_config, _url);
+	  _state = stateReceivingPost;
+	  break;
+	}
+	_statusCode = statusBadRequest; // not a form upload
+	_url[0] = '\0';
+      }
+
+      if (_url[0] == '\0' || _handler == handlerStatus ||
+	  _handler == handlerEventStream)
+	_state = stateSendingStatusCode; // No file to send
+      else
+	_state = stateUrlToFilename;
+      break;
     }
+    break;
 
-    // TO DO: save any useful headers, like authentication ones
-    char *p;
-    if ((p = replaceCharByNull(buffer, ':')) != NULL)
-      if (strcmp(buffer, "Authorization") == 0)
-	// TO DO: fix authentication
-	_isAuthenticated = true;
+  case stateReceivingPost:
+    receivePost(buffer, len);
     break;
-    
+
     // If the direct mapping between URLs and filenames is lost this
-    // causes problems for directory listings.   
+    // causes problems for directory listings.
   case stateUrlToFilename:
     switch (urlToFilename(buffer, len)) {
     case errorNoError:
       _state = stateSendingStatusCode;
       break;
     case errorFileMissing:
+      if (_statusCode == statusOK)
+	rememberMissing(); // Not an error document which is missing
       _statusCode = statusNotFound;
       _state = stateFindingErrorDocumentSetUp;
       break;
@@ -349,12 +789,12 @@ int8_t WwwServer::processRequest(char* buffer, int len)
     _iniState = IniFileState();
     _lastSlash = NULL;
     _state = stateFindingLocation;
-    
+
   case stateFindingLocation:
     // Replace URL with the redirect target URL.
     if (findLocation(buffer, len) == 0)
       break; // Not completed yet
-    
+
     _state = stateSendingStatusCode;
     break;
 
@@ -363,25 +803,37 @@ int8_t WwwServer::processRequest(char* buffer, int len)
     // getIniFileValueForUrl()
     _iniState = IniFileState();
     _lastSlash = NULL;
+    _following = false; // an error document is sent whole
     _state = stateFindingErrorDocument;
-    
+
   case stateFindingErrorDocument:
     // Replace error URL with the error document filename, otherwise
     // erase URL
     if (findErrorDocument(buffer, len) == 0)
       break; // Not completed yet
     // _state = stateSendingStatusCode;
+    if (_statusCode == statusNotFound)
+      setMissingErrorDocument(_url[0] != '\0');
 
     // having replaced the URL in the request go back to process the
     // headers which were omitted when the URL was found to be
-    // forbidden
-    _state = stateReadingHeaders; 
+    // forbidden. A missing file is only found after the headers.
+    if (!_headersRead)
+      _state = stateReadingHeaders;
+    else if (_url[0] == '\0')
+      _state = stateSendingStatusCode;
+    else
+      _state = stateUrlToFilename;
     break;
-    
+
   case stateSendingStatusCode:
+    if (!canSend())
+      break;
     sendStatusCode();
     switch (_handler) {
     case handlerDefault:
+    case handlerInclude:
+    case handlerTimeRange:
     case handlerDirectoryListing:
     case handlerForbidden:
     case handlerMovedPermanently:
@@ -392,7 +844,11 @@ int8_t WwwServer::processRequest(char* buffer, int len)
     case handlerStatus:
       _state = stateRunningStatusHandler;
       break;
-      
+
+    case handlerEventStream:
+      _state = stateSubscribingEventStream;
+      break;
+
     default:
       _statusCode = statusInternalServerError;
       strncpy(_url, "Unknown handler in state stateSendingStatusCode",
@@ -402,18 +858,20 @@ int8_t WwwServer::processRequest(char* buffer, int len)
       break;
     }
     break;
-    
+
   case stateRunningDefaultHandler:
+    if (!canSend())
+      break;
     _state = defaultHandler(buffer, len);
     break;
 
   case stateSendingFileMimeTypeSetUp:
     // Reset the variable which holds state information for
-    // _ini.getValue()
+    // _config->_ini.getValue()
     _iniState = IniFileState();
     _state = stateSendingFileMimeType;
     break;
-    
+
   case stateSendingFileMimeType:
     switch (sendFileMimeType(false, buffer, len)) {
     case 0:
@@ -431,7 +889,7 @@ int8_t WwwServer::processRequest(char* buffer, int len)
 
   case stateSendingDefaultMimeTypeSetUp:
     // Reset the variable which holds state information for
-    // _ini.getValue()
+    // _config->_ini.getValue()
     _iniState = IniFileState();
     _state = stateSendingDefaultMimeType;
     break;
@@ -441,45 +899,71 @@ int8_t WwwServer::processRequest(char* buffer, int len)
       // Found and sent
       _state = stateSendingFile;
     break;
-    
+
   case stateSendingFile:
     // make repeated calls to send files
+    if (!canSend())
+      break;
     if (sendFile(buffer, len))
       _state = stateClosingConnection;
     break;
 
+  case stateSendingCachedFile:
+    if (!canSend())
+      break;
+    if (sendCachedFile(buffer, len))
+      _state = stateClosingConnection;
+    break;
+
   case stateSendingDirectoryListingHeader:
+    if (!canSend())
+      break;
     sendDirectoryListingHeader();
     _state = stateSendingDirectoryListingBody;
     break;
 
   case stateSendingDirectoryListingBody:
+    if (!canSend())
+      break;
     if (sendDirectoryListingBody(buffer, len))
       _state = stateSendingDirectoryListingFooter;
     break;
 
   case stateSendingDirectoryListingFooter:
+    if (!canSend())
+      break;
     sendDirectoryListingFooter();
     _state = stateClosingConnection;
     break;
 
   case stateRunningStatusHandler:
+    if (!canSend())
+      break;
     sendStatus();
     _state = stateClosingConnection;
     break;
 
+  case stateSubscribingEventStream:
+    subscribeEventStream();
+    // The connection now belongs to the event stream
+    _state = stateDisconnecting;
+    break;
+
   case stateClosingConnection:
     // give the web browser time to receive the data
-    if (micros() < _stateData + 2000000UL)
+    if (WWW_SERVER_MICROS() - _responseEnded < WWW_SERVER_CLOSE_DELAY)
       break;
     _state = stateDisconnecting;
     break;
 
   case stateDisconnecting:
     // close the connection:
+    addBytesSent();
+    _topUrls.addUsage(_urlHash, _bytesSent, getRequestDuration() / 1000);
+    logRequestEnd();
     disconnect();
     break;
-    
+
   default:
     i = errorUnknownState;
     _statusCode = statusBadRequest;
@@ -489,89 +973,284 @@ int8_t WwwServer::processRequest(char* buffer, int len)
   }
 
   if (_state != initialState) {
-    if (_state == stateClosingConnection)
-      _stateData = micros();
-    else
-      _stateData = 0;
+    _stateData = 0;
+    if (_state == stateClosingConnection) {
+      _responseEnded = WWW_SERVER_MICROS();
+      _responseEndKnown = true;
+    }
   }
 
+  // Event stream subscribers and file followers are served
+  // independently of the current request
+  boolean streamed = _eventStream.service(len);
+  if (!streamed && len > 0)
+    streamed = _follow.service(buffer, len);
+
+#if WWW_SERVER_MEMORY_STATS > 0
+  // Measure even when nothing was done so that idle calls are not
+  // blamed on the next state
+  measureMemory(initialState);
+#endif
+
   // Don't include details when nothing was done
-  if (_state != stateNoClient || initialState != stateNoClient)
+  if (_state != stateNoClient || initialState != stateNoClient || streamed)
     updateStats(startMicros, initialState);
 
   return _state;
 }
 
-int8_t WwwServer::parseMethodUrlQueryString(char* buffer, int len)
+// Add the characters of the request line which have arrived. Returns
+// 1 once the line is complete and valid, 0 if more is needed, or
+// negative if the request is bad.
+int8_t WwwServer::readRequestLine(void)
 {
-  int i = readLineFromClient(buffer, len);
-  char *p, *q;
-  // Shortest valid request is "GET /"
-  if (i < 0) 
-    return errorRequestUriTooLong;
-  
-  // find end of method
-  if ((p = replaceCharByNull(buffer, ' ')) == NULL)
-    return errorBadRequest;
-
-  if ((i = findString(methodNames, buffer)) == -1)
-    return errorBadRequest;
-  _method = i;
-    
-  // find end of URL; may be terminated with a space or a '?'
-  ++p; // go to start of URL
-  if ((q = replaceCharByNull(p, '?')) == NULL) 
-    // no query string
-    replaceCharByNull(p, ' ');
-  else {
-    // found a query string
-    replaceCharByNull(++q, ' ');
-    strncpy(_queryString, q, WWW_SERVER_MAX_QUERY_LEN);
-    _queryString[WWW_SERVER_MAX_QUERY_LEN] = '\0';
-  }
-
-  strncpy(_url, p, WWW_SERVER_MAX_URL_LEN);
-  _url[WWW_SERVER_MAX_URL_LEN] = '\0';
-
-  // Check for bad URLs
-  if (_url[0] != '/') {
-    _url[0] = '\0';
-    return errorBadRequest; // not absolute as it should be
+  while (_client.available()) {
+    char c = _client.read();
+    int8_t i;
+    if (c == '\r' || c == '\n') {
+      // Ignore empty lines before the request line
+      if (_linePart == partMethod && _lineLen == 0)
+	continue;
+      _skipLF = (c == '\r');
+      return endRequestLine();
+    }
+    if ((i = addRequestLineChar(c)) < 0)
+      return i;
   }
+  if (!_client.connected())
+    return endRequestLine();
+  return 0;
+}
 
-  strncpy(_url, p, WWW_SERVER_MAX_URL_LEN);
-  _url[WWW_SERVER_MAX_URL_LEN] = '\0'; // ensure _url is terminated
-  return errorNoError;
+// As readRequestLine() for a request line already read, without the
+// line ending
+int8_t WwwServer::parseRequestLine(const char* line)
+{
+  int8_t i;
+  while (*line)
+    if ((i = addRequestLineChar(*line++)) < 0)
+      return i;
+  return endRequestLine();
 }
 
-int8_t WwwServer::setHandler(char* buffer, int len)
+// Split the request line into the method, _url and _query as it
+// arrives, a character at a time
+int8_t WwwServer::addRequestLineChar(char c)
 {
-  int8_t done = getIniFileValueForUrl("handler", buffer, len);
-  int i;
-  switch (done) {
-  case 0:
-    break; // still looking for the handler
-  case 1:
-    if ((i = findString(handlerNames, buffer)) != -1)
-      _handler = i;
+  switch (_linePart) {
+  case partMethod:
+    if (c == ' ') {
+      if ((_method = findString(methodNames, _line)) == -1)
+	return errorBadRequest;
+      _linePart = partUrl;
+      _lineLen = 0;
+    }
+    else if (_lineLen < WWW_SERVER_MAX_METHOD_LEN) {
+      _line[_lineLen++] = c;
+      _line[_lineLen] = '\0';
+    }
+    else
+      return errorBadRequest;
     break;
-  default:
-    _handler = handlerForbidden; // no handler, or unknown
+
+  case partUrl:
+    // May be terminated with a space or a '?'
+    if (c == '?' || c == ' ') {
+      _linePart = (c == '?' ? partQuery : partVersion);
+      _lineLen = 0;
+    }
+    else if (_lineLen < WWW_SERVER_MAX_URL_LEN) {
+      _url[_lineLen++] = c;
+      _url[_lineLen] = '\0';
+    }
+    else
+      return errorRequestUriTooLong;
+    break;
+
+  case partQuery:
+    // Kept undecoded until it is needed
+    if (c == ' ') {
+      _linePart = partVersion;
+      _lineLen = 0;
+    }
+    else if (_lineLen < _queryLen - 1) {
+      _query[_lineLen++] = c;
+      _query[_lineLen] = '\0';
+    }
+    else
+      return errorRequestUriTooLong;
     break;
+
+  default:
+    break; // the HTTP version is not needed
   }
-  return done;
+  return 0;
 }
 
-int8_t WwwServer::findString(const char** stringTable, char* str) const
+// Check the complete request line. Returns 1 if it is valid.
+int8_t WwwServer::endRequestLine(void)
 {
-  int8_t i = 0;
-  while (stringTable[i]) {
-    if (strcmp(str, stringTable[i]) == 0) { 
-      return i;
-    }
+  boolean haveUrl = (_linePart != partMethod);
+  _lineLen = 0;
+  // Shortest valid request is "GET /"
+  if (!haveUrl)
+    return errorBadRequest;
+
+  if ((int)(strlen(_query) + countValuelessParameters(_query)) >= _queryLen)
+    return errorRequestUriTooLong;
+
+  // Check for bad URLs
+  if (_url[0] != '/')
+    return errorBadRequest; // not absolute as it should be
+
+  // All later lookups must see the same URL for the same resource
+  if (canonicaliseUrl(_url) < 0)
+    return errorBadRequest;
+  return 1;
+}
+
+// Decode %XX escapes and remove empty, "." and ".." segments from an
+// absolute URL, in place and in one pass. A decoded '/' separates
+// segments like any other. A trailing slash is kept, so that
+// directories can still be recognised. Returns errorBadRequest if the
+// URL contains a control character, raw or encoded, or goes above the
+// root. Bytes of 0x80 and above are allowed for UTF-8.
+int8_t WwwServer::canonicaliseUrl(char* url)
+{
+  char *r = url + 1; // read position
+  char *w = url + 1; // write position
+  char *segment = w; // start of current segment in output
+
+  while (true) {
+    char c = *r;
+    int8_t hi, lo;
+    if (c == '%' && (hi = hexValue(r[1])) >= 0 &&
+	(lo = hexValue(r[2])) >= 0) {
+      c = (hi << 4) | lo;
+      if (c == '\0')
+	return errorBadRequest;
+      r += 3;
+    }
+    else if (c)
+      ++r;
+    if (c && ((uint8_t)c < 0x20 || c == 0x7F))
+      return errorBadRequest;
+
+    if (c != '/' && c != '\0') {
+      *w++ = c;
+      continue;
+    }
+
+    // End of a segment
+    int len = w - segment;
+    if (len == 1 && segment[0] == '.')
+      w = segment;
+    else if (len == 2 && segment[0] == '.' && segment[1] == '.') {
+      if (segment == url + 1)
+	return errorBadRequest; // above root
+      // Remove the previous segment
+      w = segment - 1;
+      while (w[-1] != '/')
+	--w;
+    }
+    else if (len && c == '/')
+      *w++ = '/';
+    segment = w;
+
+    if (c == '\0')
+      break;
+  }
+  *w = '\0';
+  return errorNoError;
+}
+
+// Choose the next state once the request line has been parsed
+void WwwServer::startRequest(int8_t error)
+{
+  logRequestStart(error >= 0);
+  if (error < 0) {
+    // Never show any part of a bad request
+    _url[0] = '\0';
+    _query[0] = '\0';
+    if (error == errorRequestUriTooLong)
+      _statusCode = statusRequestUriTooLong;
+    else
+      _statusCode = statusBadRequest;
+    _state = stateSendingStatusCode;
+    return;
+  }
+
+  // Answered without looking at the ini file or SD card
+  if (!isHostAllowedForUrl(_url, getHostAddress(_client))) {
+    _statusCode = statusForbidden;
+    _url[0] = '\0';
+    _state = stateReadingHeaders;
+    return;
+  }
+
+  // URLs not served by this instance are treated as missing
+  if (!isUrlAllowed()) {
+    _statusCode = statusNotFound;
+    _url[0] = '\0';
+    _state = stateReadingHeaders;
+    return;
+  }
+
+  // Only requests which may be served count towards the limits and
+  // the top URLs
+  _urlHash = hash(_url);
+  _topUrls.addRequest(_urlHash, _url);
+  if (!chargeRateLimit()) {
+    _statusCode = statusTooManyRequests;
+    _state = stateClosingConnection;
+    return;
+  }
+
+  // Skip the ini file and SD card if the URL is known not to exist
+  switch (findMissing()) {
+  case 0:
+    _statusCode = statusNotFound;
+    _url[0] = '\0';
+    _state = stateReadingHeaders;
+    break;
+  case 1:
+    _statusCode = statusNotFound;
+    _state = stateFindingErrorDocumentSetUp;
+    break;
+  default:
+    _state = stateGettingHandlerSetUp;
+    break;
+  }
+}
+
+int8_t WwwServer::setHandler(char* buffer, int len)
+{
+  int8_t done = getIniFileValueForUrl("handler", buffer, len);
+  int i;
+  switch (done) {
+  case 0:
+    break; // still looking for the handler
+  case 1:
+    if ((i = findString(handlerNames, buffer)) != -1)
+      _handler = i;
+    break;
+  default:
+    _handler = handlerForbidden; // no handler, or unknown
+    break;
+  }
+  return done;
+}
+
+int8_t WwwServer::findString(const char** stringTable, const char* str) const
+{
+  int8_t i = 0;
+  while (stringTable[i]) {
+    if (strcmp(str, stringTable[i]) == 0) {
+      return i;
+    }
     ++i;
   };
-  
+
   return -1;
 }
 
@@ -583,15 +1262,15 @@ int8_t WwwServer::findString(const char** stringTable, char* str) const
 int8_t WwwServer::getIniFileValueForUrl(const char* key, char* buffer, int len)
 {
   int8_t done;
-  _ini.open();
+  _config->_ini.open();
   if (_lastSlash == NULL || _lastSlash != _url)
     // Look for the key in the ini file section for the current value
     // of _url. Whilst _lastSlash == NULL this is the complete URL. If not
     // found for the original URL it will be a shortened version.
-    done = _ini.getValue(_url, key, buffer, len);
+    done = _config->_ini.getValue(_url, key, buffer, len);
   else
     // Could not find for any of the intermediate directories so try /
-    done = _ini.getValue("/", key, buffer, len);
+    done = _config->_ini.getValue("/", key, buffer, len);
 
   char *rs;
   switch (done) {
@@ -605,12 +1284,12 @@ int8_t WwwServer::getIniFileValueForUrl(const char* key, char* buffer, int len)
 	*_lastSlash = '/'; // Restore
       break;
     }
-    
+
     // Not found for this URL, but can try a shorter version
     rs = strrchr(_url, '/');
     if (_lastSlash)
       *_lastSlash = '/'; // replace previously deleted /
-    
+
     if (rs) {
       done = 0; // try again!
       _iniState = IniFileState(); // reset the readLine state
@@ -633,11 +1312,90 @@ int8_t WwwServer::getIniFileValueForUrl(const char* key, char* buffer, int len)
       *_lastSlash = '/';
     break;
   }
-  
+
   // _ini.close();
   return done;
 }
 
+int8_t WwwServer::hexValue(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// Copy src to dst, decoding %XX escapes and '+', until the end of the
+// string or either stop character. dst is null-terminated, and both
+// are left pointing after the characters used. Returns the stop
+// character, or '\0'. dst may equal src.
+char WwwServer::percentDecode(char*& dst, char*& src, char stop1, char stop2)
+{
+  while (*src && *src != stop1 && *src != stop2) {
+    int8_t hi, lo;
+    if (*src == '+') {
+      *dst++ = ' ';
+      ++src;
+    }
+    else if (*src == '%' && (hi = hexValue(src[1])) >= 0 &&
+	     (lo = hexValue(src[2])) >= 0) {
+      *dst++ = (hi << 4) | lo;
+      src += 3;
+    }
+    else
+      *dst++ = *src++;
+  }
+  char c = *src;
+  if (c)
+    ++src;
+  *dst++ = '\0';
+  return c;
+}
+
+// Number of parameters in a query string without '='. Each needs an
+// extra byte when decoded.
+int WwwServer::countValuelessParameters(const char* s)
+{
+  int n = 0;
+  while (*s) {
+    const char *end = strchr(s, '&');
+    if (end == NULL)
+      end = s + strlen(s);
+    if (end != s && memchr(s, '=', end - s) == NULL)
+      ++n;
+    s = (*end ? end + 1 : end);
+  }
+  return n;
+}
+
+// Convert the query string to key\0value\0 pairs. The string is first
+// moved up by the extra space needed for parameters without values,
+// so that the decoded pairs never overtake the undecoded text.
+void WwwServer::decodeQuery(void)
+{
+  if (_queryEnd >= 0)
+    return;
+  int extra = countValuelessParameters(_query);
+  char *src = _query + extra;
+  memmove(src, _query, strlen(_query) + 1);
+
+  char *dst = _query;
+  while (*src) {
+    if (*src == '&') {
+      ++src; // empty parameter
+      continue;
+    }
+    if (percentDecode(dst, src, '=', '&') == '=')
+      percentDecode(dst, src, '&', '&');
+    else
+      *dst++ = '\0'; // no value
+  }
+  _queryEnd = dst - _query;
+}
+
 char* WwwServer::replaceCharByNull(char *s, char c)
 {
   while (s && *s != '\0') {
@@ -663,6 +1421,75 @@ void WwwServer::redirectToDirectory(void)
   _statusCode = statusMovedPermanently;
 }
 
+// Look up allow post for the URL. Returns 1 if uploads may be saved
+// there, 0 if still looking, otherwise negative.
+int8_t WwwServer::checkPostAllowed(char* buffer, int len)
+{
+  int8_t done = getIniFileValueForUrl("allow post", buffer, len);
+  if (done == 1 && (strcmp(buffer, "true") != 0 || !_upload.isEnabled()))
+    done = IniFile::errorKeyNotFound;
+  return done;
+}
+
+// Act on one request header line
+void WwwServer::parseHeader(char* buffer)
+{
+  // TO DO: save any useful headers, like authentication ones
+  char *p;
+  if ((p = replaceCharByNull(buffer, ':')) == NULL)
+    return;
+  ++p;
+  while (*p == ' ' || *p == '\t')
+    ++p;
+
+  if (strcmp(buffer, "Authorization") == 0)
+    // TO DO: fix authentication
+    _isAuthenticated = true;
+  else if (_method == methodPost) {
+    if (strcasecmp(buffer, "Content-Type") == 0)
+      _upload.setContentType(p);
+    else if (strcasecmp(buffer, "Content-Length") == 0)
+      _upload.setContentLength(strtoul(p, NULL, 10));
+  }
+}
+
+// Pass as much of the request body as has arrived to the upload
+// parser, then send the response once it is complete
+void WwwServer::receivePost(char* buffer, int len)
+{
+  int n = _client.available();
+  if (n <= 0) {
+    if (!_client.connected()) {
+      _upload.abort();
+      _state = stateDisconnecting;
+    }
+    return;
+  }
+  if (n > len)
+    n = len;
+  if ((unsigned long)n > _upload.getRemaining())
+    n = _upload.getRemaining();
+  n = _client.read((uint8_t*)buffer, n);
+
+  switch (_upload.process(buffer, n)) {
+  case WwwUpload::uploadContinue:
+    return;
+  case WwwUpload::uploadDone:
+    _statusCode = (_upload.getFilesSaved() ? statusCreated : statusOK);
+    _url[0] = '\0';
+    break;
+  case WwwUpload::uploadBadRequest:
+    _statusCode = statusBadRequest;
+    _url[0] = '\0';
+    break;
+  default:
+    _statusCode = statusInternalServerError;
+    strcpy(_url, "Could not save file");
+    break;
+  }
+  _state = stateSendingStatusCode;
+}
+
 // Find the target URL for redirections. It is an error if the location
 // cannot be found.
 int8_t WwwServer::findLocation(char* buffer, int len)
@@ -675,7 +1502,7 @@ int8_t WwwServer::findLocation(char* buffer, int len)
   switch (done) {
   case 0:
     break; // still looking
-    
+
   case 1:
     if (strlen(buffer) <= WWW_SERVER_MAX_URL_LEN)
       strcpy(_url, buffer); // May not start with http://..., fix later
@@ -702,7 +1529,8 @@ int8_t WwwServer::findErrorDocument(char* buffer, int len)
   int8_t done = getIniFileValueForUrl(errorDocumentKeys[_statusCode], buffer,
 				      len);
   if (done != 0) {
-    if (strlen(buffer) <= WWW_SERVER_MAX_URL_LEN && SD.exists(buffer))
+    if (strlen(buffer) <= WWW_SERVER_MAX_URL_LEN &&
+	(_config->_fileCache.find(buffer) >= 0 || SD.exists(buffer)))
       strcpy(_url, buffer);
     else
       _url[0] = '\0';
@@ -724,12 +1552,36 @@ int8_t WwwServer::urlToFilename(char* buffer, int len)
 {
   // TO DO: map URLs to filenames?
   int8_t i = errorNoError;
-  
+
+  // Small files may be held in RAM
+  int entry = -1;
+  if (isFileCacheable())
+    entry = _config->_fileCache.find(_url);
+#if WWW_FILE_CACHE_CHECK_SIZE == 0
+  if (entry >= 0) {
+    _cacheEntry = entry;
+    return errorNoError;
+  }
+#endif
+
   // Check if file exists, and if so if it is a directory
-  if (_file)
+  if (_file && !releasePooledFile())
     _file.close();
-  _file = SD.open(_url, FILE_READ);
-  if (!_file) 
+  _fileHash = hash(_url);
+  if (!takePooledFile())
+    _file = SD.open(_url, FILE_READ);
+#if WWW_FILE_CACHE_CHECK_SIZE > 0
+  if (entry >= 0) {
+    if (_file && !_file.isDirectory() &&
+	_file.size() == _config->_fileCache.getSize(entry)) {
+      _cacheEntry = entry;
+      return errorNoError;
+    }
+    // Changed on the card since it was cached
+    _config->_fileCache.invalidate(_url);
+  }
+#endif
+  if (!_file)
     i = errorFileMissing;
   else {
     if (_file.isDirectory()) {
@@ -747,7 +1599,7 @@ int8_t WwwServer::urlToFilename(char* buffer, int len)
   else
     Serial.println(" succeeded");
 #endif
-  
+
   return i;
 }
 
@@ -773,7 +1625,7 @@ int8_t WwwServer::defaultHandler(char* buffer, int len)
     _client.println();
     return stateClosingConnection;
   }
-    
+
   if (_url[0] == '\0' || _statusCode == statusInternalServerError) {
     // No data to send (no file or error document) so send our own
     sendError();
@@ -785,6 +1637,12 @@ int8_t WwwServer::defaultHandler(char* buffer, int len)
   case handlerForbidden:
   case handlerMovedPermanently:
   case handlerTemporaryRedirect:
+    if (_cacheEntry >= 0)
+      return stateSendingCachedFile;
+    return stateSendingFileMimeTypeSetUp;
+
+  case handlerInclude:
+  case handlerTimeRange:
     return stateSendingFileMimeTypeSetUp;
 
   case handlerDirectoryListing:
@@ -796,13 +1654,13 @@ int8_t WwwServer::defaultHandler(char* buffer, int len)
     _statusCode = statusInternalServerError;
     sendError("Unknown handler in defaultHandler()");
     return stateClosingConnection;
-  }      
+  }
 }
 
 int8_t WwwServer::sendFileMimeType(boolean defaultType, char* buffer, int len)
 {
   int8_t done = IniFile::errorKeyNotFound;
-  const char mimeTypeSection[] = "mime types"; 
+  const char mimeTypeSection[] = "mime types";
   const char defStr[] = "default";
   const char *cp = defStr;
   if (!defaultType) {
@@ -812,15 +1670,227 @@ int8_t WwwServer::sendFileMimeType(boolean defaultType, char* buffer, int len)
   }
 
   if (cp)
-    done = _ini.getValue(mimeTypeSection, cp, buffer, len);
+    done = _config->_ini.getValue(mimeTypeSection, cp, buffer, len);
 
   if (done == 1) {
     _client.print(contentType);
     _client.println(buffer);
+
+    // Keep a copy of small files as they are sent
+    if (isFileCacheable() &&
+	_file.size() <= _config->_fileCache.getMaxFileSize())
+      _fillingCache = (_config->_fileCache.create(_url, buffer, _file.size()) >= 0);
   }
   return done;
 }
 
+// As sendFile() but pass the file through the include filter. The
+// first half of buffer is used for reading the file and the second
+// half for building chunks.
+int8_t WwwServer::sendIncludeFile(char* buffer, int len)
+{
+  if (!_includeStarted) {
+    sendCacheHeaders();
+    _client.println("Transfer-Encoding: chunked");
+    _client.println(); // send blank line after headers
+    _include.start();
+    startBandwidthLimit();
+    _includeStarted = true;
+  }
+
+  // Variables may make the output longer than the template, so it is
+  // limited to what the client has room for, and to the length of the
+  // buffer to keep the call short. _stateData only counts the template
+  // used; the rest is read again next time.
+  int half = len / 2;
+  int n = getSendAllowance(half);
+  if (n <= 0)
+    return 0;
+  // Within one 512 byte SD block, so that reading the same template
+  // again costs no more block reads
+  if (n > 512 - (int)(_stateData % 512))
+    n = 512 - (int)(_stateData % 512);
+  int bytesRead = _file.read(buffer, n);
+  if (bytesRead < 0)
+    bytesRead = 0;
+  boolean end = !_file.available();
+  int space = _client.availableForWrite();
+  if (space > len)
+    space = len;
+  unsigned long length = _include.getLength();
+  _stateData += _include.process(_client, buffer, bytesRead, buffer + half,
+				 len - half, space, end);
+  unsigned long sent = _include.getLength() - length;
+  chargeSend(sent);
+  _bytesSent += sent;
+  return _include.isEnded();
+}
+
+// Apply the request line, headers and request deadlines, all measured
+// from when the connection was accepted, and tell the client with 408
+// Request Timeout. They only apply until the response starts; after
+// that a client is only dropped if it stops accepting data (see
+// canSend()).
+void WwwServer::checkTimeouts(uint32_t now)
+{
+  if (_state >= stateSendingStatusCode)
+    return;
+  unsigned long elapsed = now - _requestStarted;
+  boolean expired = (_requestTimeout && elapsed >= _requestTimeout);
+  if (_state == stateReadingMethod)
+    expired |= (_requestLineTimeout && elapsed >= _requestLineTimeout);
+  else if (_state == stateReadingHeaders)
+    expired |= (_headersTimeout && elapsed >= _headersTimeout);
+  if (!expired)
+    return;
+
+  statsSet_t& s = beginStatsUpdate();
+  ++s.total.requestsTimedOut;
+  ++s.current.requestsTimedOut;
+  endStatsUpdate();
+
+  if (_state == stateReadingMethod)
+    logRequestStart(false);
+  _upload.abort(); // remove any partly received file
+  _statusCode = statusRequestTimeout;
+  _handler = handlerDefault;
+  _url[0] = '\0';
+  _state = stateSendingStatusCode;
+}
+
+// Check that the client can accept WWW_SERVER_MIN_TX_SPACE bytes, so
+// that writing to it does not wait. Drop a client which has had no
+// room for the TX timeout.
+boolean WwwServer::canSend(void)
+{
+  if (_client.availableForWrite() >= WWW_SERVER_MIN_TX_SPACE) {
+    _txWaiting = false;
+    return true;
+  }
+  uint32_t now = WWW_SERVER_MICROS();
+  if (!_txWaiting) {
+    _txWaiting = true;
+    _txWaitStarted = now;
+  }
+  else if (_txTimeout && now - _txWaitStarted >= _txTimeout) {
+    statsSet_t& s = beginStatsUpdate();
+    ++s.total.requestsTimedOut;
+    ++s.current.requestsTimedOut;
+    endStatsUpdate();
+    _state = stateDisconnecting;
+  }
+  return false;
+}
+
+// Read the bandwidth limit for the URL, starting with a full bucket
+void WwwServer::startBandwidthLimit(void)
+{
+  const policy_t *pp = findPolicy(_url, policyBandwidth);
+  _usPerByte = 0;
+  if (pp == NULL)
+    return;
+  _usPerByte = 1000000UL / pp->bandwidthLimit;
+  _bandwidthBurst = pp->bandwidthLimit * WWW_SERVER_BANDWIDTH_BURST / 1000;
+  if (_bandwidthBurst == 0)
+    _bandwidthBurst = 1;
+  _bandwidthTokens = _bandwidthBurst;
+  _bandwidthUpdated = WWW_SERVER_MICROS();
+}
+
+// Number of bytes, up to len, which may be sent now: no more than the
+// client can accept without waiting, and within any bandwidth limit.
+// The limit is a token bucket holding one byte per _usPerByte, up to
+// _bandwidthBurst; data is sent when the bucket holds len bytes or is
+// full, so that it goes in a few large writes rather than many small
+// ones.
+int WwwServer::getSendAllowance(int len)
+{
+  int space = _client.availableForWrite();
+  if (len > space)
+    len = space;
+  if (_usPerByte == 0 || len <= 0)
+    return len;
+
+  // Keep the part of a byte not yet earned for next time
+  uint32_t now = WWW_SERVER_MICROS();
+  unsigned long earned = (now - _bandwidthUpdated) / _usPerByte;
+  if (_bandwidthTokens + earned >= _bandwidthBurst) {
+    _bandwidthTokens = _bandwidthBurst;
+    _bandwidthUpdated = now;
+  }
+  else {
+    _bandwidthTokens += earned;
+    _bandwidthUpdated += earned * _usPerByte;
+  }
+
+  if ((unsigned long)len > _bandwidthBurst)
+    len = _bandwidthBurst;
+  if (_bandwidthTokens < (unsigned long)len)
+    return 0;
+  return len;
+}
+
+void WwwServer::chargeSend(int n)
+{
+  if (_usPerByte && n > 0)
+    _bandwidthTokens -= n;
+}
+
+// Only whole files are cached. Templates are never cached since their
+// output changes, nor are files being followed.
+boolean WwwServer::isFileCacheable(void) const
+{
+  return _handler != handlerInclude && _handler != handlerTimeRange &&
+    !_following;
+}
+
+// Send the header line and the rows between the from and to times
+// given in the query string. The rows are found first, so that the
+// Content-Length is known. _stateData counts the bytes sent.
+int8_t WwwServer::sendTimeRange(char* buffer, int len)
+{
+  if (!_timeRangeFound) {
+    if (!_timeRangeStarted) {
+      _timeRange.start(_file, getQueryValue("from"), getQueryValue("to"));
+      _timeRangeStarted = true;
+    }
+    if (!_timeRange.search(buffer, len))
+      return 0; // come back to search some more
+    _timeRangeFound = true;
+
+    sendCacheHeaders();
+    _client.print("Content-Length: ");
+    _client.println(_timeRange.getHeaderLength() + _timeRange.getEnd()
+		    - _timeRange.getStart(), DEC);
+    _client.println(); // send blank line after headers
+    startBandwidthLimit();
+  }
+
+  // Bytes up to the end of the header line, then the rows
+  unsigned long position = _stateData;
+  unsigned long end = _timeRange.getHeaderLength();
+  if (position >= end) {
+    position += _timeRange.getStart() - end;
+    end = _timeRange.getEnd();
+  }
+  if (position >= end)
+    return 1;
+  if ((unsigned long)len > end - position)
+    len = end - position;
+  if ((len = getSendAllowance(len)) == 0)
+    return 0;
+  if (!_file.seek(position))
+    return errorFileError;
+  int bytesRead = _file.read(buffer, len);
+  if (bytesRead <= 0)
+    return errorFileError;
+  _client.write((const uint8_t*)buffer, bytesRead);
+  chargeSend(bytesRead);
+  _stateData += bytesRead;
+  _bytesSent += bytesRead;
+  return 0; // come back to send some more
+}
+
 // Return 1 to indicate all data sent. Use _stateData to store the file
 // position
 int8_t WwwServer::sendFile(char* buffer, int len)
@@ -835,7 +1905,10 @@ int8_t WwwServer::sendFile(char* buffer, int len)
   Serial.print(" _stateData=");
   Serial.println(_stateData);
 #endif
-  
+
+  if (_handler == handlerTimeRange)
+    return sendTimeRange(buffer, len);
+
   // Send file contents
   if (!_file.seek(_stateData)) {
     //_file.close();
@@ -854,17 +1927,32 @@ int8_t WwwServer::sendFile(char* buffer, int len)
 #endif
     return errorFileError;
   }
-  
+
+  if (_handler == handlerInclude)
+    return sendIncludeFile(buffer, len);
+  if (_following) {
+    followFile();
+    return 1;
+  }
+
   if (_stateData == 0) {
+    sendCacheHeaders();
     _client.print("Content-Length: ");
     _client.println(_file.size(), DEC);
     _client.println(); // send blank line after headers
+    startBandwidthLimit();
   }
 
-
+  if ((unsigned long)len > _file.size() - _stateData)
+    len = _file.size() - _stateData;
+  len = getSendAllowance(len);
   int bytesRead = _file.read(buffer, len);
   _client.write((const uint8_t*)buffer, bytesRead);
+  chargeSend(bytesRead);
   _stateData += bytesRead;
+  _bytesSent += bytesRead;
+  if (_fillingCache && bytesRead > 0)
+    _fillingCache = _config->_fileCache.append(_url, buffer, bytesRead);
   if (!_file.available()) {
     //_file.close();
     return 1;
@@ -874,6 +1962,43 @@ int8_t WwwServer::sendFile(char* buffer, int len)
   return 0; // come back to send some more
 }
 
+// Send a file held in the RAM cache. The entry is looked up again on
+// each call since it may have been moved to make space for other
+// files. Return 1 to indicate all data sent.
+int8_t WwwServer::sendCachedFile(char* buffer, int len)
+{
+  _cacheEntry = _config->_fileCache.find(_url);
+  if (_cacheEntry < 0) {
+    if (_stateData == 0)
+      _client.println(); // send blank line after headers
+    return errorFileMissing;
+  }
+
+  uint16_t size = _config->_fileCache.getSize(_cacheEntry);
+  if (_stateData == 0) {
+    _client.print(contentType);
+    _client.println(_config->_fileCache.getMimeType(_cacheEntry));
+    sendCacheHeaders();
+    _client.print("Content-Length: ");
+    _client.println(size, DEC);
+    _client.println(); // send blank line after headers
+    startBandwidthLimit();
+  }
+
+  int n = size - _stateData;
+  if (n > len)
+    n = len;
+  n = getSendAllowance(n);
+  _client.write((const uint8_t*)_config->_fileCache.getData(_cacheEntry) + _stateData,
+		n);
+  chargeSend(n);
+  _stateData += n;
+  _bytesSent += n;
+  if (_stateData >= size)
+    return 1;
+  return 0; // come back to send some more
+}
+
 void WwwServer::printHtmlPageHeader(const char* title)
 {
   _client.print(contentType); _client.println(textHtml);
@@ -934,19 +2059,123 @@ void WwwServer::sendDirectoryListingFooter(void)
 // Send the web server status
 void WwwServer::sendStatus(void)
 {
+  stats_t stats;
+  getStats(stats);
   printHtmlPageHeader("Web server status");
   _client.print("<p>Total requests: ");
-  _client.print(_stats.requestCount, DEC);
+  _client.print(stats.requestCount, DEC);
+  _client.print("<br />\nCalls to processRequest(): ");
+  _client.print(stats.callCount, DEC);
+  _client.print("<br />\nBytes sent: ");
+  _client.print(stats.bytesSent, DEC);
+  _client.print("<br />\nRejected requests: ");
+  _client.print(stats.requestsRejected, DEC);
+  _client.print("<br />\nRate limited requests: ");
+  _client.print(stats.requestsRateLimited, DEC);
+  _client.print("<br />\nDenied connections: ");
+  _client.print(stats.connectionsDenied, DEC);
+  _client.print("<br />\nTimed out requests: ");
+  _client.print(stats.requestsTimedOut, DEC);
+  _client.print("<br />\nEvent stream subscribers: ");
+  _client.print(_eventStream.getSubscriberCount(), DEC);
+  _client.print("<br />\nFile followers: ");
+  _client.print(_follow.getFollowerCount(), DEC);
   _client.print("<br />\nWorst case request time: ");
-  _client.print(_stats.requestTimeWorstCase, DEC);
+  _client.print(stats.requestTimeWorstCase, DEC);
   _client.print("uS<br />\nWorst case task time: ");
-  _client.print(_stats.taskTimeWorstCase, DEC);
+  _client.print(stats.taskTimeWorstCase, DEC);
   _client.println("uS<br />\nWorst case task state: ");
-  _client.print(_stats.taskWorstCaseState, DEC);
+  _client.print(stats.taskWorstCaseState, DEC);
+#if WWW_SERVER_MEMORY_STATS > 0
+  _client.print("<br />\nWorst case stack use: ");
+  _client.print(stats.stackWorstCase, DEC);
+  _client.print(" bytes in state ");
+  _client.print(stats.stackWorstCaseState, DEC);
+  _client.print("<br />\nLeast free memory: ");
+  _client.print(stats.memoryFreeLowest, DEC);
+  _client.println(" bytes</p>");
+
+  _client.println("<table><tr><th>State</th><th>Stack used</th>"
+		  "<th>Least free</th></tr>");
+  uint16_t stackUsed, memoryFree;
+  for (int8_t i = 0; i <= stateDisconnecting; ++i)
+    if (getMemoryUse(i, stackUsed, memoryFree)) {
+      _client.print("<tr><td>");
+      _client.print(i, DEC);
+      _client.print("</td><td>");
+      _client.print(stackUsed, DEC);
+      _client.print("</td><td>");
+      _client.print(memoryFree, DEC);
+      _client.println("</td></tr>");
+    }
+  _client.println("</table>");
+#else
   _client.println("</p>");
+#endif
+
+#if WWW_TOP_URLS_SIZE > 0
+  _client.println("<table><tr><th>URL</th><th>Requests</th><th>Bytes</th>"
+		  "<th>Time (ms)</th></tr>");
+  const WwwTopUrls::entry_t *ep;
+  for (uint8_t i = 0; (ep = _topUrls.getEntry(i)) != NULL; ++i) {
+    _client.print("<tr><td>");
+    printHtmlEscaped(_client, ep->name);
+    _client.print("</td><td>");
+    _client.print(ep->requests, DEC);
+    if (ep->error) {
+      _client.print(" (-");
+      _client.print(ep->error, DEC);
+      _client.print(')');
+    }
+    _client.print("</td><td>");
+    _client.print(ep->bytes, DEC);
+    _client.print("</td><td>");
+    _client.print(ep->time, DEC);
+    _client.println("</td></tr>");
+  }
+  _client.println("</table>");
+#endif
   printHtmlPageFooter();
 }
 
+// Send the response headers and hand the connection over to the event
+// stream
+void WwwServer::subscribeEventStream(void)
+{
+  _client.print(contentType);
+  _client.println("text/event-stream");
+  _client.println("Cache-Control: no-cache");
+  _client.println();
+  if (_eventStream.subscribe(_client))
+    _client = EthernetClient();
+}
+
+// Send the response headers and hand the connection over to the
+// followers, starting from the position given in the query string
+void WwwServer::followFile(void)
+{
+  unsigned long size = _file.size();
+  unsigned long position = 0;
+  const char *cp;
+  if ((cp = getQueryValue("offset")) != NULL)
+    position = strtoul(cp, NULL, 10);
+  else {
+    unsigned long tail = WWW_SERVER_FOLLOW_TAIL;
+    if ((cp = getQueryValue("tail")) != NULL)
+      tail = strtoul(cp, NULL, 10);
+    if (tail < size)
+      position = size - tail;
+  }
+  if (position > size)
+    position = size;
+
+  _client.println("Cache-Control: no-cache");
+  _client.println("Transfer-Encoding: chunked");
+  _client.println(); // send blank line after headers
+  if (_follow.follow(_client, _url, position))
+    _client = EthernetClient();
+}
+
 // For cases when no error document exists make one on demand
 void WwwServer::sendError(const char *s)
 {
@@ -971,35 +2200,1222 @@ int8_t WwwServer::getState(void) const
 
 const WwwServer::stats_t* WwwServer::getStats(void)
 {
-  return &_stats;
+  return &_stats.total;
 }
 
-void WwwServer::updateStats(unsigned long startMicros, int8_t initialState)
+// Copy again if an update was in progress or happened part way
+// through. Updates are made with interrupts disabled, so an interrupt
+// handler never needs to.
+void WwwServer::getStats(stats_t& stats, uint8_t which) const
 {
-  unsigned long endMicros = micros();
-  unsigned long duration = endMicros - startMicros;
-  
-  if (endMicros < startMicros)
-    // rollover!
-    duration = (ULONG_MAX - startMicros) + 1 + endMicros;
-  
-  if (duration > _stats.taskTimeWorstCase) {
-    _stats.taskTimeWorstCase = duration;
-    _stats.taskWorstCaseState = initialState;
-  }
+  uint8_t sequence;
+  do {
+    sequence = _statsSequence;
+    if (which == statsCurrentWindow)
+      stats = _stats.current;
+    else if (which == statsPreviousWindow)
+      stats = _stats.previous;
+    else
+      stats = _stats.total;
+  } while ((sequence & 1) || sequence != _statsSequence);
+}
 
-  if (initialState == stateNoClient)
-    _stats.requestStarted = startMicros;
-  else
-    if (initialState == stateDisconnecting) {
-      _stats.requestCount += 1;
-      duration = endMicros - _stats.requestStarted;
-      if (endMicros < _stats.requestStarted) 
-	// rollover!
-	duration = (ULONG_MAX - _stats.requestStarted) + 1 + endMicros;
+void WwwServer::setStatsWindow(unsigned long interval)
+{
+  _statsWindow = interval;
+  startStatsWindow();
+}
 
-      if (duration > _stats.requestTimeWorstCase)
-	_stats.requestTimeWorstCase = duration;
-    }
+void WwwServer::startStatsWindow(void)
+{
+  statsSet_t& s = beginStatsUpdate();
+  s.previous = s.current;
+  clearStats(s.current);
+  endStatsUpdate();
+  _statsWindowStart = WWW_SERVER_MILLIS();
+}
+
+void WwwServer::resetStats(void)
+{
+  statsSet_t& s = beginStatsUpdate();
+  clearStats(s.total);
+  clearStats(s.current);
+  clearStats(s.previous);
+  endStatsUpdate();
+  _statsWindowStart = WWW_SERVER_MILLIS();
+  _topUrls.clear();
+}
+
+const WwwTopUrls& WwwServer::getTopUrls(void) const
+{
+  return _topUrls;
+}
+
+void WwwServer::setTimeouts(unsigned long requestLine, unsigned long headers,
+			    unsigned long request, unsigned long tx)
+{
+  _requestLineTimeout = requestLine;
+  _headersTimeout = headers;
+  _requestTimeout = request;
+  _txTimeout = tx;
 }
 
+void WwwServer::setIdlePollInterval(unsigned long interval)
+{
+  _idlePollInterval = interval;
+}
+
+boolean WwwServer::isWorkPending(void) const
+{
+  return getWakeDelay() == 0;
+}
+
+unsigned long WwwServer::getWakeDelay(void) const
+{
+  unsigned long elapsed, remaining;
+  unsigned long followDelay = _follow.getWakeDelay();
+  // Events are sent whatever the state of the current request
+  if (_eventStream.isPending() || followDelay == 0)
+    return 0;
+  switch (_state) {
+  case stateNoClient:
+    if (_idlePollInterval == 0 || _accessLog.isSectorReady())
+      return 0; // must poll every time, or log to write
+#if WWW_SERVER_MAX_QUEUED > 0
+    for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i)
+      if (_queue[i].used)
+	return 0;
+#endif
+    elapsed = WWW_SERVER_MICROS() - _lastIdlePoll;
+    if (elapsed >= _idlePollInterval)
+      return 0;
+    remaining = _idlePollInterval - elapsed;
+    return (followDelay < remaining ? followDelay : remaining);
+
+  case stateSendingFile:
+  case stateSendingCachedFile:
+    // With a bandwidth limit, until the bucket is full
+    if (_usPerByte == 0 || _bandwidthTokens >= _bandwidthBurst)
+      return 0;
+    elapsed = WWW_SERVER_MICROS() - _bandwidthUpdated;
+    remaining = (_bandwidthBurst - _bandwidthTokens) * _usPerByte;
+    if (elapsed >= remaining)
+      return 0;
+    remaining -= elapsed;
+    return (followDelay < remaining ? followDelay : remaining);
+
+  case stateClosingConnection:
+    elapsed = WWW_SERVER_MICROS() - _responseEnded;
+    if (elapsed >= WWW_SERVER_CLOSE_DELAY)
+      return 0;
+    remaining = WWW_SERVER_CLOSE_DELAY - elapsed;
+    return (followDelay < remaining ? followDelay : remaining);
+
+  default:
+    return 0;
+  }
+}
+
+void WwwServer::updateStats(uint32_t startMicros, int8_t initialState)
+{
+  uint32_t endMicros = WWW_SERVER_MICROS();
+  statsSet_t& s = beginStatsUpdate();
+  uint32_t now = WWW_SERVER_MILLIS();
+  if (_statsWindow && now - _statsWindowStart >= _statsWindow) {
+    s.previous = s.current;
+    clearStats(s.current);
+    _statsWindowStart = now;
+  }
+  updateStats(s.total, startMicros, endMicros, initialState);
+  updateStats(s.current, startMicros, endMicros, initialState);
+  // Calls which only served event streams or followers are not part
+  // of any request
+  if (initialState != stateNoClient || _state != stateNoClient) {
+    ++s.total.callCount;
+    ++s.current.callCount;
+  }
+#if WWW_SERVER_MEMORY_STATS > 0
+  updateMemoryStats(s.total, initialState);
+  updateMemoryStats(s.current, initialState);
+#endif
+  endStatsUpdate();
+}
+
+#if WWW_SERVER_MEMORY_STATS > 0
+void WwwServer::measureMemory(int8_t state)
+{
+  char *lowest = measureStack();
+  _stackUsed = (char*)RAMEND - lowest;
+  _memoryFree = lowest - heapEnd();
+  memoryUse_t *mp = &_memoryUse[state];
+  if (_stackUsed > mp->stackUsed)
+    mp->stackUsed = _stackUsed;
+  if (_memoryFree < mp->memoryFree)
+    mp->memoryFree = _memoryFree;
+}
+
+void WwwServer::updateMemoryStats(stats_t& stats, int8_t state) const
+{
+  if (_stackUsed > stats.stackWorstCase) {
+    stats.stackWorstCase = _stackUsed;
+    stats.stackWorstCaseState = state;
+  }
+  if (_memoryFree < stats.memoryFreeLowest)
+    stats.memoryFreeLowest = _memoryFree;
+}
+#endif
+
+boolean WwwServer::getMemoryUse(int8_t state, uint16_t& stackUsed,
+				uint16_t& memoryFree) const
+{
+#if WWW_SERVER_MEMORY_STATS > 0
+  if (state < 0 || state > stateDisconnecting ||
+      _memoryUse[state].stackUsed == 0)
+    return false;
+  stackUsed = _memoryUse[state].stackUsed;
+  memoryFree = _memoryUse[state].memoryFree;
+  return true;
+#else
+  (void)state;
+  (void)stackUsed;
+  (void)memoryFree;
+  return false;
+#endif
+}
+
+void WwwServer::updateStats(stats_t& stats, uint32_t startMicros,
+			    uint32_t endMicros, int8_t initialState)
+{
+  // Correct across the rollover of micros()
+  uint32_t duration = endMicros - startMicros;
+
+  if (duration > stats.taskTimeWorstCase) {
+    stats.taskTimeWorstCase = duration;
+    stats.taskWorstCaseState = initialState;
+  }
+
+  if (initialState == stateNoClient)
+    stats.requestStarted = startMicros;
+  else
+    if (initialState == stateDisconnecting) {
+      stats.requestCount += 1;
+      duration = endMicros - stats.requestStarted;
+
+      if (duration > stats.requestTimeWorstCase)
+	stats.requestTimeWorstCase = duration;
+    }
+}
+
+void WwwServer::addBytesSent(void)
+{
+  statsSet_t& s = beginStatsUpdate();
+  s.total.bytesSent += _bytesSent;
+  s.current.bytesSent += _bytesSent;
+  endStatsUpdate();
+}
+
+void WwwServer::clearStats(stats_t& stats)
+{
+  unsigned long requestStarted = stats.requestStarted;
+  memset(&stats, 0, sizeof(stats));
+  stats.requestStarted = requestStarted; // may be mid-request
+  stats.taskWorstCaseState = -1;
+#if WWW_SERVER_MEMORY_STATS > 0
+  stats.stackWorstCaseState = -1;
+  stats.memoryFreeLowest = 0xFFFF;
+#endif
+}
+
+// Return the statistics to be modified in place. Keep updates short,
+// interrupts are disabled until endStatsUpdate().
+WwwServer::statsSet_t& WwwServer::beginStatsUpdate(void)
+{
+  noInterrupts();
+  ++_statsSequence; // odd whilst updating
+  return _stats;
+}
+
+void WwwServer::endStatsUpdate(void)
+{
+  ++_statsSequence;
+  interrupts();
+}
+
+
+// Search for the current URL in the list of missing URLs. Return -1
+// if not found, otherwise 1 if an error document applies, or 0 if
+// not.
+int8_t WwwServer::findMissing(void) const
+{
+#if WWW_SERVER_MISS_CACHE_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_MISS_CACHE_SIZE; ++i)
+    if (_config->_missing[i].urlHash == _urlHash && _urlHash != 0)
+      return _config->_missing[i].errorDocument;
+#endif
+  return -1;
+}
+
+void WwwServer::rememberMissing(void)
+{
+#if WWW_SERVER_MISS_CACHE_SIZE > 0
+  if (findMissing() != -1)
+    return;
+  // Assume an error document applies until it is known otherwise
+  _config->_missing[_config->_missingNext].urlHash = _urlHash;
+  _config->_missing[_config->_missingNext].errorDocument = true;
+  if (++_config->_missingNext >= WWW_SERVER_MISS_CACHE_SIZE)
+    _config->_missingNext = 0;
+#endif
+}
+
+void WwwServer::setMissingErrorDocument(boolean errorDocument)
+{
+#if WWW_SERVER_MISS_CACHE_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_MISS_CACHE_SIZE; ++i)
+    if (_config->_missing[i].urlHash == _urlHash)
+      _config->_missing[i].errorDocument = errorDocument;
+#endif
+}
+
+// Take the file for _fileHash from the pool of open files, and put it
+// into _file.
+boolean WwwServer::takePooledFile(void)
+{
+#if WWW_SERVER_FILE_POOL_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_FILE_POOL_SIZE; ++i) {
+    if (_config->_filePool[i].fileHash != _fileHash || _fileHash == 0)
+      continue;
+
+    // Move the file out of the pool, without closing it
+    _file = _config->_filePool[i].file;
+    _config->_filePool[i].file = File();
+    _config->_filePool[i].fileHash = 0;
+
+    // Guard against hash collisions, the name is the final part of
+    // the URL
+    const char *cp = strrchr(_url, '/');
+    if (cp == NULL || strcasecmp(cp + 1, _file.name()) != 0) {
+      _file.close();
+      return false;
+    }
+    _file.seek(0);
+    return true;
+  }
+#endif
+  return false;
+}
+
+// Put _file into the pool of open files, closing the least recently
+// used file if there is no space. Returns false if _file cannot be
+// pooled.
+boolean WwwServer::releasePooledFile(void)
+{
+#if WWW_SERVER_FILE_POOL_SIZE > 0
+  if (_fileHash == 0 || _file.isDirectory())
+    return false;
+
+  uint8_t victim = 0;
+  uint16_t oldest = 0;
+  for (uint8_t i = 0; i < WWW_SERVER_FILE_POOL_SIZE; ++i) {
+    if (_config->_filePool[i].fileHash == 0) {
+      victim = i;
+      break;
+    }
+    uint16_t age = _config->_filePoolClock - _config->_filePool[i].lastUsed;
+    if (age >= oldest) {
+      oldest = age;
+      victim = i;
+    }
+  }
+
+  if (_config->_filePool[victim].fileHash)
+    _config->_filePool[victim].file.close();
+  _config->_filePool[victim].file = _file;
+  _config->_filePool[victim].fileHash = _fileHash;
+  _config->_filePool[victim].lastUsed = ++_config->_filePoolClock;
+  _file = File();
+  _fileHash = 0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Read the URL sections of the ini file for settings which are needed
+// before the ini file can be searched, and store them in
+// _config->_policies. Values apply to the section's URL and all URLs below it.
+boolean WwwServer::loadPolicies(char* buffer, int len)
+{
+  File file = SD.open(_config->getFilename(), FILE_READ);
+  if (!file)
+    return false;
+
+  _config->_numPolicies = 0;
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  _config->_numHostRules = 0;
+#endif
+  boolean ok = true;
+  uint32_t sectionHash = 0; // 0 when not in a URL section
+  while (file.available()) {
+    if (readLine(file, buffer, len) < 0)
+      continue; // too long, not one of ours
+
+    char *key = buffer;
+    while (isspace(*key))
+      ++key;
+    if (*key == '[') {
+      char *end = strchr(++key, ']');
+      if (end && *key == '/') {
+	*end = '\0';
+	sectionHash = hash(key);
+      }
+      else
+	sectionHash = 0;
+      continue;
+    }
+    if (sectionHash == 0 || *key == ';' || *key == '#')
+      continue;
+
+    // Split into key and value, removing surrounding whitespace
+    char *value = replaceCharByNull(key, '=');
+    if (value == NULL)
+      continue;
+    char *end = value;
+    while (end > key && isspace(*(end - 1)))
+      *--end = '\0';
+    ++value;
+    while (isspace(*value))
+      ++value;
+    end = value + strlen(value);
+    while (end > value && isspace(*(end - 1)))
+      *--end = '\0';
+
+    policy_t *pp;
+    int8_t i;
+    long n;
+    if (strcmp(key, "priority") == 0 &&
+	(i = findString(priorityNames, value)) != -1 &&
+	(pp = getPolicy(sectionHash, true)) != NULL) {
+      pp->priority = i;
+      pp->flags |= policyPriority;
+    }
+    else if (strcmp(key, "rate limit") == 0 &&
+	     (n = atol(value)) > 0 &&
+	     (pp = getPolicy(sectionHash, true)) != NULL) {
+      // Requests per minute
+      pp->rateInterval = (n > 60000L ? 1 : 60000L / n);
+      if (!(pp->flags & policyRateLimit))
+	pp->rateBurst = 1;
+      pp->flags |= policyRateLimit;
+    }
+    else if (strcmp(key, "cache control") == 0 &&
+	     (pp = getPolicy(sectionHash, true)) != NULL)
+      parseCacheControl(pp, value);
+    else if (strcmp(key, "cache max age") == 0 &&
+	     (pp = getPolicy(sectionHash, true)) != NULL) {
+      pp->cacheMaxAge = strtoul(value, NULL, 10);
+      pp->flags |= policyCacheMaxAge;
+    }
+    else if (strcmp(key, "rate limit burst") == 0 &&
+	     (n = atol(value)) > 0 &&
+	     (pp = getPolicy(sectionHash, true)) != NULL) {
+      pp->rateBurst = (n > 255 ? 255 : n);
+      if (!(pp->flags & policyRateLimit))
+	pp->rateInterval = 0; // no limit unless a rate is given
+      pp->flags |= policyRateLimit;
+    }
+    else if (strcmp(key, "bandwidth limit") == 0 &&
+	     (n = atol(value)) > 0 &&
+	     (pp = getPolicy(sectionHash, true)) != NULL) {
+      // Bytes per second, higher limits cannot be reached anyway
+      pp->bandwidthLimit = (n > 1000000L ? 1000000L : n);
+      pp->flags |= policyBandwidth;
+    }
+    else if (strncmp(key, "hosts ", 6) == 0 &&
+	     (strcmp(key + 6, "allow") == 0 ||
+	      strcmp(key + 6, "deny") == 0)) {
+      // Refuse to start rather than ignore access restrictions
+      pp = getPolicy(sectionHash, true);
+      if (pp == NULL || !parseHostRules(pp, value, key[6] == 'a'))
+	ok = false;
+    }
+  }
+  file.close();
+  return ok;
+}
+
+// Find the settings for a URL section, making a new entry if
+// requested and there is space
+WwwServer::policy_t* WwwServer::getPolicy(uint32_t sectionHash,
+					   boolean create)
+{
+  for (uint8_t i = 0; i < _config->_numPolicies; ++i)
+    if (_config->_policies[i].sectionHash == sectionHash)
+      return &_config->_policies[i];
+  if (!create || _config->_numPolicies >= WWW_SERVER_MAX_POLICIES)
+    return NULL;
+  policy_t *pp = &_config->_policies[_config->_numPolicies++];
+  pp->sectionHash = sectionHash;
+  pp->flags = 0;
+  pp->cacheDirectives = 0;
+  return pp;
+}
+
+// Find the setting indicated by flag (or any of several flags) for
+// the URL. As for getIniFileValueForUrl() the URL is tried first,
+// then each of the parent directories in turn to /. The hash of each parent directory
+// is computed on the way through the URL so no copying is needed.
+const WwwServer::policy_t* WwwServer::findPolicy(const char* url,
+						 uint8_t flag) const
+{
+  const policy_t *found = NULL;
+  uint32_t h = FNV_OFFSET_BASIS;
+  const char *cp = url;
+  while (true) {
+    if ((*cp == '/' && cp != url) || *cp == '\0') {
+      for (uint8_t i = 0; i < _config->_numPolicies; ++i)
+	if (_config->_policies[i].sectionHash == h && (_config->_policies[i].flags & flag))
+	  found = &_config->_policies[i]; // longer matches replace shorter ones
+    }
+    if (*cp == '\0')
+      break;
+    h ^= (uint8_t)*cp++;
+    h *= FNV_PRIME;
+  }
+
+  if (found == NULL) {
+    h = hash("/");
+    for (uint8_t i = 0; i < _config->_numPolicies; ++i)
+      if (_config->_policies[i].sectionHash == h && (_config->_policies[i].flags & flag))
+	found = &_config->_policies[i];
+  }
+  return found;
+}
+
+// Convert a comma-separated list of Cache-Control directives to
+// flags. max-age may also be given here.
+void WwwServer::parseCacheControl(policy_t* pp, char* value)
+{
+  pp->cacheDirectives = 0;
+  pp->flags |= policyCacheControl;
+  char *token = value;
+  while (token) {
+    char *next = replaceCharByNull(token, ',');
+    if (next)
+      ++next;
+    while (isspace(*token))
+      ++token;
+    char *end = token + strlen(token);
+    while (end > token && isspace(*(end - 1)))
+      *--end = '\0';
+
+    int8_t i;
+    if (strncmp(token, "max-age=", 8) == 0) {
+      pp->cacheMaxAge = strtoul(token + 8, NULL, 10);
+      pp->flags |= policyCacheMaxAge;
+    }
+    else if ((i = findString(cacheDirectiveNames, token)) != -1)
+      pp->cacheDirectives |= (1 << i);
+    token = next;
+  }
+}
+
+// Send Cache-Control and Expires headers for a successful response.
+// The closest section with any cache setting applies in full, so that
+// eg no-store in a directory is not mixed with a max-age from /.
+void WwwServer::sendCacheHeaders(void)
+{
+  if (_statusCode != statusOK)
+    return;
+  const policy_t *pp = findPolicy(_url,
+				  policyCacheControl | policyCacheMaxAge);
+  if (pp == NULL ||
+      (pp->cacheDirectives == 0 && !(pp->flags & policyCacheMaxAge)))
+    return; // no directive which can be sent
+
+  _client.print("Cache-Control: ");
+  const char *separator = "";
+  for (uint8_t i = 0; cacheDirectiveNames[i]; ++i)
+    if (pp->cacheDirectives & (1 << i)) {
+      _client.print(separator);
+      _client.print(cacheDirectiveNames[i]);
+      separator = ", ";
+    }
+  if (pp->flags & policyCacheMaxAge) {
+    _client.print(separator);
+    _client.print("max-age=");
+    _client.print(pp->cacheMaxAge, DEC);
+
+    // For HTTP/1.0 caches
+    unsigned long t = (_timeSource ? _timeSource() : 0);
+    if (t) {
+      _client.println();
+      _client.print("Expires: ");
+      printHttpDate(_client, t + pp->cacheMaxAge);
+    }
+  }
+  _client.println();
+}
+
+// Add the addresses in a hosts allow or hosts deny list, eg
+// "192.168.1.0/24, 10.0.0.1". Returns false if the list is invalid or
+// there is no room for it.
+boolean WwwServer::parseHostRules(policy_t* pp, char* value, boolean allow)
+{
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  char *cp = value;
+  while (true) {
+    while (*cp == ',' || isspace(*cp))
+      ++cp;
+    if (*cp == '\0')
+      break;
+
+    uint32_t address = 0;
+    for (uint8_t i = 0; i < 4; ++i) {
+      if (i && *cp++ != '.')
+	return false;
+      if (!isdigit(*cp))
+	return false;
+      unsigned long octet = strtoul(cp, &cp, 10);
+      if (octet > 255)
+	return false;
+      address = (address << 8) | octet;
+    }
+    unsigned long prefixLen = 32;
+    if (*cp == '/') {
+      if (!isdigit(*++cp))
+	return false;
+      prefixLen = strtoul(cp, &cp, 10);
+      if (prefixLen > 32)
+	return false;
+    }
+    if (*cp && *cp != ',' && !isspace(*cp))
+      return false;
+
+    if (_config->_numHostRules >= WWW_SERVER_MAX_HOST_RULES)
+      return false;
+    WwwServerConfig::hostRule_t *rp =
+      &_config->_hostRules[_config->_numHostRules++];
+    rp->address = address;
+    rp->prefixLen = prefixLen;
+    rp->policy = pp - _config->_policies;
+    rp->allow = allow;
+  }
+  pp->flags |= policyHosts;
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint32_t WwwServer::getHostAddress(EthernetClient& client)
+{
+  IPAddress ip = client.remoteIP();
+  return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) |
+    ((uint32_t)ip[2] << 8) | ip[3];
+}
+
+// An address matching a hosts allow entry is allowed, even if it also
+// matches a hosts deny entry. Otherwise it is denied if it matches a
+// hosts deny entry, or if the section has a hosts allow list.
+boolean WwwServer::isHostAllowed(const policy_t* pp, uint32_t address) const
+{
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  if (pp == NULL)
+    return true;
+  uint8_t policy = pp - _config->_policies;
+  boolean allowList = false;
+  boolean denied = false;
+  for (uint8_t i = 0; i < _config->_numHostRules; ++i) {
+    const WwwServerConfig::hostRule_t *rp = &_config->_hostRules[i];
+    if (rp->policy != policy)
+      continue;
+    uint32_t mask = (rp->prefixLen ? 0xFFFFFFFFUL << (32 - rp->prefixLen)
+		     : 0);
+    boolean match = ((address ^ rp->address) & mask) == 0;
+    if (rp->allow) {
+      if (match)
+	return true;
+      allowList = true;
+    }
+    else if (match)
+      denied = true;
+  }
+  return !(denied || allowList);
+#else
+  return true;
+#endif
+}
+
+// Every section with host rules from / down to the URL must allow
+// the address, so a subsection cannot relax the rules of its parent
+// directories. Sections are tried as in findPolicy().
+boolean WwwServer::isHostAllowedForUrl(const char* url,
+				       uint32_t address) const
+{
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  if (!isHostAllowedAnywhere(address))
+    return false;
+  uint32_t h = FNV_OFFSET_BASIS;
+  const char *cp = url;
+  while (true) {
+    if ((*cp == '/' && cp != url) || *cp == '\0') {
+      for (uint8_t i = 0; i < _config->_numPolicies; ++i) {
+	const policy_t *pp = &_config->_policies[i];
+	if (pp->sectionHash == h && (pp->flags & policyHosts) &&
+	    !isHostAllowed(pp, address))
+	  return false;
+      }
+    }
+    if (*cp == '\0')
+      break;
+    h ^= (uint8_t)*cp++;
+    h *= FNV_PRIME;
+  }
+#endif
+  return true;
+}
+
+// True unless the rules for / refuse the address. Those apply to
+// every URL, so the connection can be dropped before reading anything.
+boolean WwwServer::isHostAllowedAnywhere(uint32_t address) const
+{
+  return isHostAllowed(findPolicy("/", policyHosts), address);
+}
+
+// Drop a new connection from a client which may not access any URL,
+// before anything is read from it. Returns false if it was dropped.
+boolean WwwServer::checkHostAllowed(EthernetClient& client)
+{
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  if (_config->_numHostRules == 0 ||
+      isHostAllowedAnywhere(getHostAddress(client)))
+    return true;
+  client.stop();
+  statsSet_t& s = beginStatsUpdate();
+  ++s.total.connectionsDenied;
+  ++s.current.connectionsDenied;
+  endStatsUpdate();
+  return false;
+#else
+  return true;
+#endif
+}
+
+int8_t WwwServer::getPriority(const char* url) const
+{
+  const policy_t *pp = findPolicy(url, policyPriority);
+  if (pp)
+    return pp->priority;
+  return priorityNormal;
+}
+
+// Find the priority for an unparsed request line
+int8_t WwwServer::getRequestLinePriority(char* line) const
+{
+  char *url = strchr(line, ' ');
+  if (url == NULL)
+    return priorityLow;
+  ++url;
+  char *end = url;
+  while (*end && *end != ' ' && *end != '?')
+    ++end;
+  if (end - url > WWW_SERVER_MAX_URL_LEN)
+    return priorityLow;
+
+  // Use the same URL as the request will
+  char canonical[WWW_SERVER_MAX_URL_LEN+1];
+  memcpy(canonical, url, end - url);
+  canonical[end - url] = '\0';
+  if (canonical[0] != '/' || canonicaliseUrl(canonical) < 0)
+    return priorityLow;
+  return getPriority(canonical);
+}
+
+// Number of client connections held open
+uint8_t WwwServer::getConnectionCount(void) const
+{
+  uint8_t n = (_state != stateNoClient) + _eventStream.getSubscriberCount()
+    + _follow.getFollowerCount();
+#if WWW_SERVER_MAX_QUEUED > 0
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i)
+    n += _queue[i].used;
+#endif
+  return n;
+}
+
+// Check for a connection waiting whilst a request is being processed.
+// A new connection is given a free queue entry while its request line
+// arrives, and once the method and URL are known is either held until
+// the server is free or answered with 503 Service Unavailable. A high
+// priority request may take the place of a queued request of lower
+// priority.
+void WwwServer::admitWaitingClient(char* buffer, int len)
+{
+  uint32_t now = WWW_SERVER_MICROS();
+  if (now - _lastAdmissionPoll < WWW_SERVER_ADMISSION_POLL_INTERVAL)
+    return;
+  _lastAdmissionPoll = now;
+
+#if WWW_SERVER_MAX_QUEUED > 0
+  // Don't let slow clients keep entries
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i)
+    if (_queue[i].used && _queue[i].lineState == queuedLineReading &&
+	_requestLineTimeout &&
+	now - _queue[i].queuedAt >= _requestLineTimeout) {
+      _queue[i].client.stop();
+      _queue[i].client = EthernetClient();
+      _queue[i].used = false;
+    }
+#endif
+
+  EthernetClient client = _server.available();
+  if (!client || client == _client)
+    return;
+
+#if WWW_SERVER_MAX_QUEUED > 0
+  int8_t slot = -1;
+  int8_t lowest = -1;
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i) {
+    if (!_queue[i].used) {
+      slot = i;
+      continue;
+    }
+    if (_queue[i].client == client) {
+      // More of its request line may have arrived
+      queued_t *qp = &_queue[i];
+      if (qp->lineState == queuedLineReading) {
+	qp->lineState = readQueuedLine(client, qp->requestLine, qp->lineLen);
+	if (qp->lineState != queuedLineReading)
+	  admitQueuedClient(i);
+      }
+      return;
+    }
+    if (lowest == -1 || _queue[i].priority < _queue[lowest].priority)
+      lowest = i;
+  }
+#endif
+
+  if (!checkHostAllowed(client))
+    return;
+  if (checkRateLimit(client)) {
+    client.stop();
+    return;
+  }
+
+#if WWW_SERVER_MAX_QUEUED > 0
+  if (slot == -1) {
+    // Only a request of higher priority than one already queued can
+    // be held, and without an entry its line must have arrived whole
+    uint8_t lineLen = 0;
+    uint8_t lineState;
+    int8_t priority;
+    if (len <= WWW_SERVER_MAX_QUEUED_LINE_LEN ||
+	(lineState = readQueuedLine(client, buffer, lineLen)) ==
+	queuedLineReading ||
+	(priority = getRequestLinePriority(buffer)) <=
+	_queue[lowest].priority) {
+      rejectClient(client);
+      return;
+    }
+    // Make room by turning away a lower priority request
+    rejectClient(_queue[lowest].client);
+    queued_t *qp = &_queue[lowest];
+    qp->client = client;
+    qp->queuedAt = now;
+    qp->priority = priority;
+    qp->lineState = lineState;
+    qp->lineLen = lineLen;
+    memcpy(qp->requestLine, buffer, lineLen + 1);
+    return;
+  }
+
+  queued_t *qp = &_queue[slot];
+  qp->client = client;
+  qp->queuedAt = now;
+  qp->priority = priorityNormal;
+  qp->lineLen = 0;
+  qp->requestLine[0] = '\0';
+  qp->used = true;
+  qp->lineState = readQueuedLine(client, qp->requestLine, qp->lineLen);
+  if (qp->lineState != queuedLineReading)
+    admitQueuedClient(slot);
+#else
+  rejectClient(client);
+#endif
+}
+
+// Add the characters of a queued request line which have arrived to
+// line, which holds lineLen characters so far. Only the start of a
+// long line is kept. Returns the new state of the line.
+uint8_t WwwServer::readQueuedLine(EthernetClient& client, char* line,
+				  uint8_t& lineLen)
+{
+#if WWW_SERVER_MAX_QUEUED > 0
+  while (client.available()) {
+    char c = client.read();
+    if (c == '\r' || c == '\n') {
+      // Ignore empty lines before the request line
+      if (lineLen == 0)
+	continue;
+      return (c == '\r' ? queuedLineCompleteCR : queuedLineComplete);
+    }
+    line[lineLen++] = c;
+    line[lineLen] = '\0';
+    if (lineLen == WWW_SERVER_MAX_QUEUED_LINE_LEN)
+      return queuedLinePrefix;
+  }
+  if (!client.connected())
+    return queuedLineComplete; // nothing more will arrive
+  return queuedLineReading;
+#else
+  return 0;
+#endif
+}
+
+// The method and URL of a queued request have arrived. Keep it if the
+// admission policy allows or a queued request of lower priority can be
+// turned away instead, otherwise answer it with 503.
+void WwwServer::admitQueuedClient(uint8_t slot)
+{
+#if WWW_SERVER_MAX_QUEUED > 0
+  queued_t *qp = &_queue[slot];
+  qp->priority = getRequestLinePriority(qp->requestLine);
+  if (qp->priority >= priorityHigh)
+    return;
+  uint8_t queued = 0;
+  int8_t lowest = -1;
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i) {
+    if (!_queue[i].used || i == slot)
+      continue;
+    ++queued;
+    if (lowest == -1 || _queue[i].priority < _queue[lowest].priority)
+      lowest = i;
+  }
+  // The connection count includes this entry
+  if (queued < _maxQueued && getConnectionCount() <= _maxConcurrent)
+    return;
+  if (lowest != -1 && _queue[lowest].priority < qp->priority)
+    qp = &_queue[lowest];
+  rejectClient(qp->client);
+  qp->client = EthernetClient();
+  qp->used = false;
+#endif
+}
+
+// Start on the highest priority queued request, if any. Requests still
+// arriving are taken last, when the server has nothing else to do.
+// Whatever has been read of the request line is parsed now, and the
+// rest read as for a new connection.
+boolean WwwServer::takeQueuedClient(char* buffer, int len)
+{
+#if WWW_SERVER_MAX_QUEUED > 0
+  int8_t best = -1;
+  for (uint8_t i = 0; i < WWW_SERVER_MAX_QUEUED; ++i) {
+    if (!_queue[i].used)
+      continue;
+    if (best == -1 || _queue[i].priority > _queue[best].priority ||
+	(_queue[i].priority == _queue[best].priority &&
+	 (int32_t)(_queue[i].queuedAt - _queue[best].queuedAt) < 0))
+      best = i;
+  }
+  if (best == -1)
+    return false;
+
+  queued_t *qp = &_queue[best];
+  _client = qp->client;
+  _requestStarted = WWW_SERVER_MICROS();
+  qp->client = EthernetClient();
+  qp->used = false;
+  if (!_client.connected()) {
+    _client.stop();
+    return false;
+  }
+  int8_t i = 0;
+  for (const char *cp = qp->requestLine; *cp && i == 0; ++cp)
+    i = addRequestLineChar(*cp);
+  if (i == 0 && qp->lineState >= queuedLineComplete) {
+    _skipLF = (qp->lineState == queuedLineCompleteCR);
+    i = endRequestLine();
+  }
+  if (i == 0)
+    _state = stateReadingMethod; // the rest is still to be read
+  else
+    startRequest(i > 0 ? (int8_t)errorNoError : i);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Send the prepared 503 response and close the connection
+void WwwServer::rejectClient(EthernetClient& client)
+{
+  client.write((const uint8_t*)serviceUnavailable,
+	       sizeof(serviceUnavailable) - 1);
+  client.stop();
+  statsSet_t& s = beginStatsUpdate();
+  ++s.total.requestsRejected;
+  ++s.current.requestsRejected;
+  endStatsUpdate();
+}
+
+// Check a newly accepted client against the limit set by
+// setRateLimit(). If exceeded answer with 429 Too Many Requests and
+// return true. The limits for URL sections are charged once the
+// request line has been read.
+boolean WwwServer::checkRateLimit(EthernetClient& client)
+{
+#if WWW_SERVER_RATE_LIMIT_CLIENTS > 0
+  unsigned long wait;
+  if (_rateInterval &&
+      !chargeBucket(client.remoteIP(), acceptRateLimit, _rateInterval,
+		    _rateBurst, wait)) {
+    sendTooManyRequests(client, wait);
+    return true;
+  }
+#endif
+  return false;
+}
+
+// Charge the current request against the client's rate limit for
+// this URL. Return false if the limit is exceeded, in which case 429
+// Too Many Requests has been sent.
+boolean WwwServer::chargeRateLimit(void)
+{
+#if WWW_SERVER_RATE_LIMIT_CLIENTS > 0
+  const policy_t *pp = findPolicy(_url, policyRateLimit);
+  if (pp == NULL || pp->rateInterval == 0)
+    return true;
+  unsigned long wait;
+  if (!chargeBucket(_client.remoteIP(), pp - _config->_policies,
+		    pp->rateInterval, pp->rateBurst, wait)) {
+    sendTooManyRequests(_client, wait);
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Charge a request to the bucket for the client address and policy,
+// which allows burst requests back to back and then one every
+// interval ms. Return false if the limit is exceeded, with the ms
+// until a request would conform in wait.
+boolean WwwServer::chargeBucket(uint32_t address, uint8_t policy,
+				uint16_t interval, uint8_t burst,
+				unsigned long& wait)
+{
+#if WWW_SERVER_RATE_LIMIT_CLIENTS > 0
+  if (address == 0)
+    return true;
+
+  uint32_t now = WWW_SERVER_MILLIS();
+  rateLimit_t *rp = NULL;
+  rateLimit_t *victim = &_rateLimits[0];
+  for (uint8_t i = 0; i < WWW_SERVER_RATE_LIMIT_CLIENTS; ++i) {
+    if (_rateLimits[i].address == address &&
+	_rateLimits[i].policy == policy) {
+      rp = &_rateLimits[i];
+      break;
+    }
+    // Replace unused or least recently seen entry
+    if (_rateLimits[i].address == 0)
+      victim = &_rateLimits[i];
+    else if (victim->address &&
+	     now - _rateLimits[i].lastSeen > now - victim->lastSeen)
+      victim = &_rateLimits[i];
+  }
+  if (rp == NULL) {
+    rp = victim;
+    rp->address = address;
+    rp->policy = policy;
+    rp->arrival = now;
+  }
+  rp->lastSeen = now;
+
+  // Tolerance allows burst requests back to back
+  unsigned long tolerance = (unsigned long)(burst - 1) * interval;
+  if ((int32_t)(rp->arrival - now) < 0)
+    rp->arrival = now;
+  if (rp->arrival - now > tolerance) {
+    wait = (rp->arrival - now) - tolerance;
+    return false;
+  }
+  rp->arrival += interval;
+#endif
+  return true;
+}
+
+// Send a minimal 429 response, wait is in ms
+void WwwServer::sendTooManyRequests(EthernetClient& client,
+				    unsigned long wait)
+{
+  client.print("HTTP/1.1 ");
+  client.println(responseText[statusTooManyRequests]);
+  client.print("Retry-After: ");
+  client.println((wait + 999) / 1000, DEC);
+  client.println("Content-Length: 0");
+  client.println("Connection: close");
+  client.println();
+  statsSet_t& s = beginStatsUpdate();
+  ++s.total.requestsRateLimited;
+  ++s.current.requestsRateLimited;
+  endStatsUpdate();
+}
+
+// Print the client address, time and request line for the access log
+void WwwServer::logRequestStart(boolean haveRequestLine)
+{
+  if (!_accessLog.isEnabled())
+    return;
+  _accessLog.startEntry();
+  _accessLog.print(_client.remoteIP());
+  _accessLog.print(" - - ");
+  unsigned long t = (_timeSource ? _timeSource() : 0);
+  if (t) {
+    _accessLog.print('[');
+    printClfDate(_accessLog, t);
+    _accessLog.print("] ");
+  }
+  else
+    _accessLog.print("- ");
+
+  if (haveRequestLine) {
+    _accessLog.print('"');
+    _accessLog.print(methodNames[_method]);
+    _accessLog.print(' ');
+    _accessLog.print(_url);
+    if (_query[0] && _queryEnd < 0) {
+      _accessLog.print('?');
+      _accessLog.print(_query);
+    }
+    _accessLog.print('"');
+  }
+  else
+    _accessLog.print('-');
+}
+
+// Complete the access log entry with the status code, bytes sent and
+// duration
+void WwwServer::logRequestEnd(void)
+{
+  if (!_accessLog.isEntryStarted())
+    return;
+  _accessLog.print(' ');
+  _accessLog.write((const uint8_t*)responseText[_statusCode], 3);
+  _accessLog.print(' ');
+  if (_bytesSent)
+    _accessLog.print(_bytesSent, DEC);
+  else
+    _accessLog.print('-');
+  _accessLog.print(' ');
+  _accessLog.println(getRequestDuration(), DEC);
+  _accessLog.endEntry();
+}
+
+// Time (us) from accepting the connection to the end of the response,
+// not counting the close delay. Requests which end without a complete
+// response are timed up to the disconnect.
+unsigned long WwwServer::getRequestDuration(void)
+{
+  if (!_responseEndKnown) {
+    _responseEnded = WWW_SERVER_MICROS();
+    _responseEndKnown = true;
+  }
+  return _responseEnded - _requestStarted;
+}
+
+static void print2Digits(Print& p, uint8_t n)
+{
+  if (n < 10)
+    p.print('0');
+  p.print(n, DEC);
+}
+
+// Convert days since 1970-01-01 to a date in the Gregorian
+// calendar. Count from 0000-03-01 so that the leap day is at the end
+// of the year.
+static void daysToDate(unsigned long days, unsigned long& year,
+		       uint8_t& month, uint8_t& day)
+{
+  unsigned long z = days + 719468UL;
+  unsigned long era = z / 146097UL;
+  unsigned long doe = z - era * 146097UL; // day of era
+  unsigned long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned long mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = (mp < 10 ? mp + 3 : mp - 9);
+  year = yoe + era * 400 + (month <= 2);
+}
+
+static void printTime(Print& p, unsigned long secs)
+{
+  print2Digits(p, secs / 3600);
+  p.print(':');
+  print2Digits(p, (secs / 60) % 60);
+  p.print(':');
+  print2Digits(p, secs % 60);
+}
+
+void WwwServer::printHtmlEscaped(Print& p, const char* s)
+{
+  for (; *s; ++s)
+    switch (*s) {
+    case '<':
+      p.print("&lt;");
+      break;
+    case '>':
+      p.print("&gt;");
+      break;
+    case '&':
+      p.print("&amp;");
+      break;
+    case '"':
+      p.print("&quot;");
+      break;
+    default:
+      p.print(*s);
+    }
+}
+
+static const char monthNames[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// Example: 10/Oct/2000:13:55:36 +0000
+void WwwServer::printClfDate(Print& p, unsigned long t)
+{
+  unsigned long year;
+  uint8_t month, day;
+  daysToDate(t / 86400UL, year, month, day);
+
+  print2Digits(p, day);
+  p.print('/');
+  p.write((const uint8_t*)monthNames + 3 * (month - 1), 3);
+  p.print('/');
+  p.print(year, DEC);
+  p.print(':');
+  printTime(p, t % 86400UL);
+  p.print(" +0000");
+}
+
+// Example: Sun, 06 Nov 1994 08:49:37 GMT
+void WwwServer::printHttpDate(Print& p, unsigned long t)
+{
+  const char dayNames[] = "SunMonTueWedThuFriSat";
+  unsigned long days = t / 86400UL;
+  unsigned long year;
+  uint8_t month, day;
+  daysToDate(days, year, month, day);
+
+  // 1970-01-01 was a Thursday
+  p.write((const uint8_t*)dayNames + 3 * ((days + 4) % 7), 3);
+  p.print(", ");
+  print2Digits(p, day);
+  p.print(' ');
+  p.write((const uint8_t*)monthNames + 3 * (month - 1), 3);
+  p.print(' ');
+  p.print(year, DEC);
+  p.print(' ');
+  printTime(p, t % 86400UL);
+  p.print(" GMT");
+}
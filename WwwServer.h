@@ -8,14 +8,95 @@
 // character). This also includes URLs used in the Location header for
 // redirects.
 #define WWW_SERVER_MAX_URL_LEN 80
+// Request header lines are only kept up to this length, except for
+// uploads which use the upload buffer. Enough for the header names
+// which are used. Must be at least WWW_SERVER_MAX_METHOD_LEN.
+#define WWW_SERVER_MAX_HEADER_LEN 24
+
+// Maximum length of the query string when no buffer has been supplied
+// with setQueryBuffer(). Longer query strings are rejected with 414
+// Request-URI Too Long.
 #define WWW_SERVER_MAX_QUERY_LEN 20
 
+// Sizes of the caches shared between servers are set in
+// WwwServerConfig.h
+
+// Number of connections which can be held waiting whilst another
+// request is processed. The limit for normal and low priority
+// requests is set with setAdmissionPolicy(); high priority requests
+// may use all of the entries. Each entry holds the start of the
+// request line, enough for the method and URL, so set to 0 if RAM is
+// short. The rest of the line is read once the request is started.
+#define WWW_SERVER_MAX_QUEUED 1
+#define WWW_SERVER_MAX_QUEUED_LINE_LEN (WWW_SERVER_MAX_METHOD_LEN + 1 + \
+					WWW_SERVER_MAX_URL_LEN + 1)
+// Minimum interval (us) between checks for waiting connections
+#define WWW_SERVER_ADMISSION_POLL_INTERVAL 50000UL
+// Value of the Retry-After header sent with 503 responses (s)
+#define WWW_SERVER_RETRY_AFTER "5"
+
+// Number of rate limit buckets, one for each client address and URL
+// section (or setRateLimit()) in use. Set to 0 to disable.
+#define WWW_SERVER_RATE_LIMIT_CLIENTS 4
+
+// Number of bytes from the end of a file sent for ?follow when
+// neither tail nor offset is given
+#define WWW_SERVER_FOLLOW_TAIL 512
+
+// Default deadlines (us) for receiving the request line, the request
+// headers and the whole request including any upload, measured from
+// when the connection is accepted, and for the client to make room
+// for more data. See setTimeouts().
+#define WWW_SERVER_REQUEST_LINE_TIMEOUT 5000000UL
+#define WWW_SERVER_HEADERS_TIMEOUT 10000000UL
+#define WWW_SERVER_REQUEST_TIMEOUT 120000000UL
+#define WWW_SERVER_TX_TIMEOUT 10000000UL
+
+// Default interval (us) between checks for new connections when idle,
+// and so the longest getWakeDelay() returns then. See
+// setIdlePollInterval().
+#define WWW_SERVER_IDLE_POLL_INTERVAL 10000UL
+
+// Space the client must have for outgoing data before the server
+// writes to it. Enough for the status line and headers.
+#define WWW_SERVER_MIN_TX_SPACE 256
+
+// Set to 1 to record the stack used and the free memory left for each
+// state, on AVR only. The memory below the stack is painted by begin()
+// and the painted area checked after each call to processRequest().
+// Uses 4 bytes of RAM per state.
+#define WWW_SERVER_MEMORY_STATS 0
+#if WWW_SERVER_MEMORY_STATS > 0 && !defined(__AVR__)
+#undef WWW_SERVER_MEMORY_STATS
+#define WWW_SERVER_MEMORY_STATS 0
+#endif
+
+// Amount of data (ms worth) sent at once for URLs with a bandwidth
+// limit
+#define WWW_SERVER_BANDWIDTH_BURST 100
+
+// Delay (us) before closing a connection, to give the client time to
+// receive the data
+#define WWW_SERVER_CLOSE_DELAY 2000000UL
+
 #include <SD.h>
 #include <Ethernet.h>
+#include <WwwClock.h>
 
+#ifdef __AVR__
 #include <avr/pgmspace.h>
+#endif
 
 #include <IniFile.h>
+#include <WwwServerConfig.h>
+#include <WwwFileCache.h>
+#include <WwwAccessLog.h>
+#include <WwwEventStream.h>
+#include <WwwFollow.h>
+#include <WwwInclude.h>
+#include <WwwTimeRange.h>
+#include <WwwTopUrls.h>
+#include <WwwUpload.h>
 
 class WwwServer
 {
@@ -24,15 +105,15 @@ public:
   enum {
     methodHead = 0,
     methodGet = 1,
-    //methodPost = ?,
-    methodPut = 2,
-    methodDelete = 3,
+    methodPost = 2,
+    methodPut = 3,
+    methodDelete = 4,
   };
 
   // This must match up with responseText and errorDocumentKeys
   enum{
     statusOK = 0, // 200
-    //statusCreated, // 201
+    statusCreated, // 201
     statusMovedPermanently, // 301
     statusTemporaryRedirect, // 307
     statusBadRequest,
@@ -41,14 +122,20 @@ public:
     statusNotFound,
     statusRequestUriTooLong,
     statusInternalServerError,
+    statusTooManyRequests,
+    statusServiceUnavailable,
+    statusRequestTimeout, // 408
   };
-  
+
   enum {
     stateNoClient = 0,
     stateReadingMethod,
     stateGettingHandlerSetUp,
     stateGettingHandler,
+    stateCheckingPostSetUp,
+    stateCheckingPost,
     stateReadingHeaders,
+    stateReceivingPost,
     stateUrlToFilename,
     stateRedirectingToDirectory,
     stateFindingLocationSetUp,
@@ -62,11 +149,13 @@ public:
     stateSendingDefaultMimeTypeSetUp,
     stateSendingDefaultMimeType,
     stateSendingFile,
+    stateSendingCachedFile,
     //stateSendingDirectoryListing,
     stateSendingDirectoryListingHeader,
     stateSendingDirectoryListingBody,
     stateSendingDirectoryListingFooter,
     stateRunningStatusHandler,
+    stateSubscribingEventStream,
     stateClosingConnection,
     stateDisconnecting,
   };
@@ -82,6 +171,14 @@ public:
     errorDirectoryNoTrailingSlash = -7,
   };
 
+  // Parts of the request line
+  enum {
+    partMethod = 0,
+    partUrl,
+    partQuery,
+    partVersion,
+  };
+
   // This must match up with handlerNames
   enum {
     handlerDefault = 0,
@@ -90,17 +187,45 @@ public:
     handlerTemporaryRedirect,
     handlerStatus,
     handlerCgi,
+    handlerEventStream,
+    handlerInclude,
+    handlerTimeRange,
     handlerDirectoryListing, // internal use only
   };
 
+  // This must match up with priorityNames
+  enum {
+    priorityLow = 0,
+    priorityNormal,
+    priorityHigh,
+  };
+
   typedef struct {
-    unsigned long requestStarted;
+    uint32_t requestStarted;
     unsigned long requestCount; // total number of requests
+    unsigned long callCount; // calls to processRequest() for requests
+    unsigned long bytesSent; // response bodies of completed requests
+    unsigned long requestsRejected; // turned away with 503
+    unsigned long requestsRateLimited; // turned away with 429
+    unsigned long connectionsDenied; // dropped by hosts allow/deny
+    unsigned long requestsTimedOut; // 408 or dropped by a deadline
     unsigned long requestTimeWorstCase; // longest duration of request (uS)
     unsigned long taskTimeWorstCase; // longest duration of task (uS)
     int8_t taskWorstCaseState; // corresponding task
+#if WWW_SERVER_MEMORY_STATS > 0
+    uint16_t stackWorstCase; // most stack used (bytes)
+    int8_t stackWorstCaseState;
+    uint16_t memoryFreeLowest; // least space between heap and stack
+#endif
   } stats_t;
-  
+
+  // Which statistics getStats() copies
+  enum {
+    statsTotal = 0, // since the server was constructed or reset
+    statsCurrentWindow,
+    statsPreviousWindow,
+  };
+
   static char urlStart[];
   static char location[];
   static char contentType[];
@@ -111,34 +236,159 @@ public:
   static char titleToH1[];
   static char closeH1[];
   static char closeBodyHtml[];
-  
+  static const char serviceUnavailable[]; // complete 503 response
+
   static const char* methodNames[];
   static const char* responseText[]; // HTTP response code
   static const char* errorDocumentKeys[]; // ini file keys for error docs
   static const char* handlerNames[];
+  static const char* priorityNames[];
+  static const char* cacheDirectiveNames[];
 
   // Decode base 64 strings
   static boolean b64_decode(unsigned char* buffer, int len);
 
+  // 32 bit FNV-1a hash of a string
+  static uint32_t hash(const char* s);
+
+  // Read a line from a file or client. Return number of characters,
+  // or negative if an error
+  static int readLine(Stream& stream, char* buffer, int len);
+
+  // Print a time (seconds since 1970-01-01 00:00:00 UTC) in the format
+  // used by the Common Log Format
+  static void printClfDate(Print& p, unsigned long t);
+  // As above, in the format used by HTTP headers
+  static void printHttpDate(Print& p, unsigned long t);
+
+  // Print text received from a client so that it cannot add markup to
+  // an HTML page
+  static void printHtmlEscaped(Print& p, const char* s);
+
   //WwwServer(uint16_t port = 80);
+  // A server constructed with an ini file name uses a configuration of
+  // its own
   WwwServer(const char* iniFilename, uint16_t port = 80);
-  
+  // Use a configuration which may be shared with other servers
+  WwwServer(WwwServerConfig& config, uint16_t port = 80);
+
   boolean begin(char *buffer, int len);
+
+  // Only answer requests for URLs at or below prefix (eg "/status"),
+  // others get 404 Not Found. NULL allows all URLs.
+  void setUrlPrefix(const char* prefix);
+
+  // Keep small files in RAM, using len bytes at arena. Files no
+  // larger than maxFileSize are cached when first sent and later
+  // requests are answered without accessing the SD card.
+  void setFileCache(char* arena, int len,
+		    uint16_t maxFileSize = WWW_FILE_CACHE_MAX_FILE_SIZE);
+
+  // Call when a file has been changed or removed outside of the
+  // server, or when the SD card has been remounted, so that any
+  // cached copies are discarded.
+  void fileModified(const char* filename);
+  void mediaChanged(void);
+
+  // Limit the number of connections held open at once, and the
+  // number of normal or low priority connections which may wait
+  // whilst another request is processed. Connections beyond the
+  // limits are answered immediately with 503 Service Unavailable. Set
+  // priority = high in the ini file for URLs which must always get
+  // through.
+  void setAdmissionPolicy(uint8_t maxConcurrent, uint8_t maxQueued);
+
+  // Limit the connections accepted from each client address,
+  // whatever the URL. Connections beyond the limit are answered with
+  // 429 Too Many Requests before the request is read. Limits for URL
+  // sections are set with "rate limit" in the ini file. 0 disables.
+  void setRateLimit(uint16_t requestsPerMinute, uint8_t burst = 1);
+
+  // Keep an access log in Common Log Format, followed by the request
+  // duration (us). Entries are held in buffer and written to the SD
+  // card a sector at a time when the server is idle, or when buffer
+  // is nearly full. The log alternates between the two files, each
+  // up to maxSize bytes. The buffer should be at least 1024 bytes;
+  // false is returned if it is shorter than one sector (512 bytes).
+  boolean setAccessLog(char* buffer, int len, const char* filename1,
+		       const char* filename2, unsigned long maxSize);
+  // Write all complete entries to the card, eg before power is removed
+  void flushAccessLog(void);
+
+  // Function returning the current time as seconds since 1970-01-01
+  // 00:00:00 UTC, or 0 if not known. Used for log entries and Expires
+  // headers.
+  void setTimeSource(unsigned long (*timeSource)(void));
+
+  // Server-Sent Events. URLs with handler = event stream receive all
+  // events published after they connect. Events are held in buffer
+  // until every subscriber has been sent them, or the space is
+  // needed for newer events.
+  void setEventBuffer(char* buffer, int len);
+  boolean publishEvent(const char* data, const char* event = NULL);
+
+  // Files requested with ?follow are sent from the last tail bytes
+  // (default 512), or from byte offset, and then kept open: data
+  // appended to the file is sent as it is found, checking every
+  // pollInterval ms. The response ends after idleTimeout ms without
+  // new data. Eg /data/log.csv?follow&tail=100
+  void setFollowTiming(unsigned long pollInterval,
+		       unsigned long idleTimeout);
+
+  // Files served by the include handler have each <!--#var name-->
+  // marker replaced by the output of the callback registered for
+  // name.
+  boolean addIncludeVariable(const char* name,
+			     void (*callback)(Print& out));
+
+  // Accept multipart/form-data POST requests for URLs with allow post
+  // = true in the ini file. Files are saved in the directory given by
+  // the URL, other form fields are passed to callback. See WwwUpload.h
+  // for the size of buffer.
+  void setUploadBuffer(char* buffer, int len);
+  void setFormFieldCallback(void (*callback)(const char* name,
+					     const char* value));
+
+  // Hold query strings of up to len-1 characters in buffer instead
+  // of the small internal buffer. A parameter without a value needs
+  // one extra character.
+  void setQueryBuffer(char* buffer, int len);
+
+  // Iterate over the query string parameters of the current request,
+  // starting with pos = 0. Keys and values are percent-decoded in
+  // place. Returns the position of the following parameter, or 0 if
+  // there are no more.
+  int nextQueryParameter(int pos, const char*& key, const char*& value);
+  // Value of the first parameter named key, or NULL if not present
+  const char* getQueryValue(const char* key);
   // void stop(void); // finish with socket and ini file
 
   void disconnect(void); // finish with current client and reset variables
 
-  int readLineFromClient(char* buffer, int len);
+  int readHeaderLine(char* buffer, int len);
   char* replaceCharByNull(char *s, char c);
 
   // len is the size of the buffer
   int8_t processRequest(char* buffer, int len);
 
-  int8_t parseMethodUrlQueryString(char* buffer, int len);
+  int8_t readRequestLine(void);
+  int8_t parseRequestLine(const char* line);
+  int8_t addRequestLineChar(char c);
+  int8_t endRequestLine(void);
+  void startRequest(int8_t error);
 
   int8_t setHandler(char* buffer, int len);
+  int8_t checkPostAllowed(char* buffer, int len);
+  void parseHeader(char* buffer);
+  void receivePost(char* buffer, int len);
+
+  int8_t findString(const char** stringTable, const char* str) const;
 
-  int8_t findString(const char** stringTable, char* str) const;
+  static int8_t hexValue(char c);
+  static int8_t canonicaliseUrl(char* url);
+  static char percentDecode(char*& dst, char*& src, char stop1, char stop2);
+  static int countValuelessParameters(const char* s);
+  void decodeQuery(void);
 
   // Search the ini file for the specified key, but try first with
   // section set to the URL, then try again with each of the parent
@@ -158,45 +408,274 @@ public:
   void sendError(const char* s = NULL);
   int8_t sendFileMimeType(boolean defaultType, char* buffer, int len);
   int8_t sendFile(char* buffer, int len);
+  int8_t sendIncludeFile(char* buffer, int len);
+  int8_t sendTimeRange(char* buffer, int len);
+  boolean isFileCacheable(void) const;
+  int8_t sendCachedFile(char* buffer, int len);
 
   void sendDirectoryListingHeader(void);
   int8_t sendDirectoryListingBody(char *buffer, int len);
   void sendDirectoryListingFooter(void);
-  
+
   void sendStatus(void);
-  
+  void subscribeEventStream(void);
+  void followFile(void);
+
   void printHtmlPageHeader(const char* title);
   void printHtmlPageFooter(void);
-  
+
   int8_t getState(void) const;
+  // The statistics are updated in place, so may change whilst being
+  // read through the pointer; use the version below for a consistent
+  // copy.
   const stats_t* getStats(void);
- 
+  // Copy a consistent set of statistics. Safe to call from an
+  // interrupt handler, or from another task.
+  void getStats(stats_t& stats, uint8_t which = statsTotal) const;
+  // Collect statistics for windows of interval ms, eg worst case task
+  // time per minute. With an interval of 0 windows only change when
+  // startStatsWindow() is called.
+  void setStatsWindow(unsigned long interval);
+  // Most stack used and least free memory seen in state, in bytes.
+  // Returns false if not recorded (see WWW_SERVER_MEMORY_STATS).
+  boolean getMemoryUse(int8_t state, uint16_t& stackUsed,
+		       uint16_t& memoryFree) const;
+  void startStatsWindow(void);
+  void resetStats(void);
+  // The most requested URLs, see WwwTopUrls.h
+  const WwwTopUrls& getTopUrls(void) const;
+
+  // Deadlines (us) which stop slow or stalled clients holding the
+  // server. A client which has not sent its request line, its
+  // headers, or its whole request (eg an upload) within the time since
+  // it connected gets 408 Request Timeout. Once the response has
+  // started there is no deadline, but a client which cannot accept
+  // data for tx us is dropped. 0 disables a deadline.
+  void setTimeouts(unsigned long requestLine, unsigned long headers,
+		   unsigned long request, unsigned long tx);
+
+  // When idle only check for new connections every interval (us),
+  // calls to processRequest() in between return without accessing the
+  // Ethernet device. 0 checks on every call. The default is
+  // WWW_SERVER_IDLE_POLL_INTERVAL.
+  void setIdlePollInterval(unsigned long interval);
+
+  // Scheduling hints. isWorkPending() is true if processRequest()
+  // should be called now; getWakeDelay() returns the time (us) until
+  // it next needs to be called. A sketch may skip calls, or sleep,
+  // until then.
+  boolean isWorkPending(void) const;
+  unsigned long getWakeDelay(void) const;
+
 protected:
-  void updateStats(unsigned long startMicros, int8_t state);
+  // Statistics are updated in place. _statsSequence is odd during an
+  // update so that readers can tell if their copy is consistent.
+  typedef struct {
+    stats_t total;
+    stats_t current;
+    stats_t previous;
+  } statsSet_t;
+
+  void init(void);
+  boolean isUrlAllowed(void) const;
+  static void clearStats(stats_t& stats);
+  statsSet_t& beginStatsUpdate(void);
+  void endStatsUpdate(void);
+  static void updateStats(stats_t& stats, uint32_t startMicros,
+			  uint32_t endMicros, int8_t state);
+  void updateStats(uint32_t startMicros, int8_t state);
+  void addBytesSent(void);
+#if WWW_SERVER_MEMORY_STATS > 0
+  void measureMemory(int8_t state);
+  void updateMemoryStats(stats_t& stats, int8_t state) const;
+#endif
+
+  int8_t findMissing(void) const;
+  void rememberMissing(void);
+  void setMissingErrorDocument(boolean errorDocument);
+
+  boolean takePooledFile(void);
+  boolean releasePooledFile(void);
+
+  // Settings read from URL sections of the ini file by begin()
+  enum {
+    policyPriority = 0x01,
+    policyRateLimit = 0x02,
+    policyCacheControl = 0x04,
+    policyCacheMaxAge = 0x08,
+    policyHosts = 0x10,
+    policyBandwidth = 0x20,
+  };
+  typedef WwwServerConfig::policy_t policy_t;
+  boolean loadPolicies(char* buffer, int len);
+  policy_t* getPolicy(uint32_t sectionHash, boolean create);
+  const policy_t* findPolicy(const char* url, uint8_t flag) const;
+  void parseCacheControl(policy_t* pp, char* value);
+  void sendCacheHeaders(void);
+  boolean parseHostRules(policy_t* pp, char* value, boolean allow);
+  static uint32_t getHostAddress(EthernetClient& client);
+  boolean isHostAllowed(const policy_t* pp, uint32_t address) const;
+  boolean isHostAllowedForUrl(const char* url, uint32_t address) const;
+  boolean isHostAllowedAnywhere(uint32_t address) const;
+  boolean checkHostAllowed(EthernetClient& client);
+  int8_t getPriority(const char* url) const;
+  int8_t getRequestLinePriority(char* line) const;
+
+  uint8_t getConnectionCount(void) const;
+  void admitWaitingClient(char* buffer, int len);
+  static uint8_t readQueuedLine(EthernetClient& client, char* line,
+				uint8_t& lineLen);
+  void admitQueuedClient(uint8_t slot);
+  boolean takeQueuedClient(char* buffer, int len);
+  void rejectClient(EthernetClient& client);
+
+  boolean checkRateLimit(EthernetClient& client);
+  boolean chargeRateLimit(void);
+  boolean chargeBucket(uint32_t address, uint8_t policy, uint16_t interval,
+		       uint8_t burst, unsigned long& wait);
+  void sendTooManyRequests(EthernetClient& client, unsigned long wait);
+
+  void checkTimeouts(uint32_t now);
+  boolean canSend(void);
+  void startBandwidthLimit(void);
+  int getSendAllowance(int len);
+  void chargeSend(int n);
+
+  void logRequestStart(boolean haveRequestLine);
+  void logRequestEnd(void);
+  unsigned long getRequestDuration(void);
+
 private:
+  // Not copyable, the copy would use the original's _ownConfig
+  WwwServer(const WwwServer&);
+  WwwServer& operator=(const WwwServer&);
 
   class GetIniFileValueForUrlState;
-  
+
   // Keep a copy of the port since Server class has no accessor
   int16_t _port;
-  IniFile _ini;
+  WwwServerConfig _ownConfig; // unused if a config was passed in
+  WwwServerConfig* _config;
+  const char* _urlPrefix;
+
+  // Admission control
+  uint8_t _maxConcurrent; // 0 when admission control is disabled
+  uint8_t _maxQueued;
+  uint32_t _lastAdmissionPoll;
+
+  // Rate limit checked when a connection is accepted
+  uint16_t _rateInterval; // ms per request, 0 when not limited
+  uint8_t _rateBurst;
+  unsigned long _idlePollInterval;
+  uint32_t _lastIdlePoll;
+
+  // Timeouts (us)
+  unsigned long _requestLineTimeout;
+  unsigned long _headersTimeout;
+  unsigned long _requestTimeout;
+  unsigned long _txTimeout;
+  uint32_t _requestStarted; // when the connection was accepted
+  uint32_t _responseEnded; // before the close delay
+  boolean _responseEndKnown;
+  uint32_t _txWaitStarted;
+  boolean _txWaiting;
+
+  // Bandwidth limit for the current response
+  unsigned long _usPerByte; // 0 when not limited
+  unsigned long _bandwidthBurst; // bucket size (bytes)
+  unsigned long _bandwidthTokens;
+  uint32_t _bandwidthUpdated;
+
+#if WWW_SERVER_RATE_LIMIT_CLIENTS > 0
+  // Rate limiting uses the generic cell rate algorithm, which is
+  // equivalent to a token bucket but needs only one time per bucket.
+  // Times are in ms.
+  static const uint8_t acceptRateLimit = 0xFF; // policy for setRateLimit()
+  typedef struct {
+    uint32_t address; // 0 when unused
+    uint8_t policy; // index into the policies, or acceptRateLimit
+    uint32_t arrival; // theoretical arrival time of next request
+    uint32_t lastSeen;
+  } rateLimit_t;
+  rateLimit_t _rateLimits[WWW_SERVER_RATE_LIMIT_CLIENTS];
+#endif
+#if WWW_SERVER_MAX_QUEUED > 0
+  // How much of a queued request line has arrived
+  enum {
+    queuedLineReading = 0,
+    queuedLinePrefix, // entry full, the rest is still to be read
+    queuedLineComplete,
+    queuedLineCompleteCR, // ended with '\r', ignore a following '\n'
+  };
+  typedef struct {
+    EthernetClient client;
+    uint32_t queuedAt;
+    int8_t priority; // normal until the method and URL have arrived
+    uint8_t lineState;
+    uint8_t lineLen;
+    boolean used;
+    char requestLine[WWW_SERVER_MAX_QUEUED_LINE_LEN+1];
+  } queued_t;
+  queued_t _queue[WWW_SERVER_MAX_QUEUED];
+#endif
+
+  // The request line and headers are read as they arrive, which may
+  // be a few characters at a time
+  uint8_t _linePart; // part of the request line being read
+  int _lineLen; // characters read of the part or header line
+  boolean _skipLF; // last line ended with '\r', ignore a following '\n'
+  char _line[WWW_SERVER_MAX_HEADER_LEN+1]; // method, or a header line
+  boolean _headersRead; // the empty line ending the headers has arrived
 
   int8_t _method;
   char _url[WWW_SERVER_MAX_URL_LEN+1];
+  uint32_t _urlHash; // hash of the canonical URL
   char _queryString[WWW_SERVER_MAX_QUERY_LEN+1];
+  char* _query; // _queryString or a user-supplied buffer
+  int _queryLen; // size of _query
+  int _queryEnd; // length after decoding, or -1 if not yet decoded
   File _file; // The file to be sent. Kept open between requests
+  uint32_t _fileHash; // hash of filename if _file may be pooled, else 0
+  int _cacheEntry; // Cache entry being sent, or -1
+  boolean _fillingCache; // Copy data from _file into the cache
   int8_t _handler;
   int8_t _statusCode;
   boolean _isAuthenticated;
 
   // status information
-  stats_t _stats;
-  
+  statsSet_t _stats;
+  volatile uint8_t _statsSequence; // incremented before and after updates
+  unsigned long _statsWindow; // ms, or 0 for manual windows
+  uint32_t _statsWindowStart;
+  unsigned long _bytesSent; // body bytes sent for the current request
+#if WWW_SERVER_MEMORY_STATS > 0
+  typedef struct {
+    uint16_t stackUsed;
+    uint16_t memoryFree;
+  } memoryUse_t;
+  memoryUse_t _memoryUse[stateDisconnecting + 1];
+  uint16_t _stackUsed; // measured after the last call
+  uint16_t _memoryFree;
+#endif
+
+  WwwAccessLog _accessLog;
+  WwwEventStream _eventStream;
+  WwwFollow _follow;
+  boolean _following; // ?follow requested for a file
+  WwwInclude _include;
+  WwwTimeRange _timeRange;
+  WwwTopUrls _topUrls;
+  boolean _timeRangeStarted;
+  boolean _timeRangeFound;
+  boolean _includeStarted; // headers sent
+  WwwUpload _upload;
+  unsigned long (*_timeSource)(void);
+
   EthernetServer _server;
   EthernetClient _client;
 
   // State information when accessing ini file
-  IniFileState _iniState; 
+  IniFileState _iniState;
 
   // ***** State variables for some member functions. *****
   // Can't use static storage scope inside functions since that results
@@ -204,7 +683,7 @@ private:
   // web servers (on different ports) simultaneously.
 
   // State information for processRequest()
-  int8_t _state; 
+  int8_t _state;
   // In stateSendingFile this is the position in the file.  In
   // stateClosingConnection this is the millis at which the state was
   // entered in order to give a sufficient delay for the data to be
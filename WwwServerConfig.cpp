@@ -0,0 +1,71 @@
+#include <WwwServerConfig.h>
+#include <WwwServer.h>
+
+WwwServerConfig::WwwServerConfig(const char* iniFilename)
+  : _filename(iniFilename), _ini(iniFilename)
+{
+  _loaded = false;
+  _numPolicies = 0;
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  _numHostRules = 0;
+#endif
+  clearMissing();
+#if WWW_SERVER_FILE_POOL_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_FILE_POOL_SIZE; ++i)
+    _filePool[i].fileHash = 0;
+  _filePoolClock = 0;
+#endif
+}
+
+const char* WwwServerConfig::getFilename(void) const
+{
+  return _filename;
+}
+
+boolean WwwServerConfig::isLoaded(void) const
+{
+  return _loaded;
+}
+
+void WwwServerConfig::setFileCache(char* arena, int len,
+				   uint16_t maxFileSize)
+{
+  _fileCache.begin(arena, len, maxFileSize);
+}
+
+void WwwServerConfig::fileModified(const char* filename)
+{
+  _fileCache.invalidate(filename);
+  closePooledFile(WwwServer::hash(filename));
+  // A new file may also have created new directories
+  clearMissing();
+}
+
+void WwwServerConfig::mediaChanged(void)
+{
+  _fileCache.clear();
+  clearMissing();
+  closePooledFile(0);
+}
+
+void WwwServerConfig::clearMissing(void)
+{
+#if WWW_SERVER_MISS_CACHE_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_MISS_CACHE_SIZE; ++i)
+    _missing[i].urlHash = 0;
+  _missingNext = 0;
+#endif
+}
+
+// Close pooled files matching fileHash, or all if fileHash is 0
+void WwwServerConfig::closePooledFile(uint32_t fileHash)
+{
+#if WWW_SERVER_FILE_POOL_SIZE > 0
+  for (uint8_t i = 0; i < WWW_SERVER_FILE_POOL_SIZE; ++i)
+    if (_filePool[i].fileHash &&
+	(fileHash == 0 || _filePool[i].fileHash == fileHash)) {
+      _filePool[i].file.close();
+      _filePool[i].fileHash = 0;
+    }
+#endif
+}
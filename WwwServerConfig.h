@@ -0,0 +1,113 @@
+#ifndef WWWSERVERCONFIG_H
+#define WWWSERVERCONFIG_H
+
+// Number of recently requested URLs which are remembered as not
+// existing. Set to 0 to disable.
+#define WWW_SERVER_MISS_CACHE_SIZE 8
+
+// Number of files kept open between requests, to avoid searching
+// the FAT directories when the same file is requested again. Set to 0
+// to disable.
+#define WWW_SERVER_FILE_POOL_SIZE 2
+
+// Number of URL sections in the ini file which may have settings
+// which are read when the server starts (eg priority)
+#define WWW_SERVER_MAX_POLICIES 8
+
+// Number of hosts allow and hosts deny entries (addresses or CIDR
+// blocks) which can be read from the ini file. Set to 0 to disable;
+// begin() then fails if the ini file has any.
+#define WWW_SERVER_MAX_HOST_RULES 8
+
+#include <SD.h>
+#include <IniFile.h>
+#include <WwwFileCache.h>
+
+class WwwServer;
+
+// Configuration and caches which can be shared by several servers,
+// eg the same site served on two ports. The ini file is opened and
+// its URL sections read once, by the first server to call begin();
+// the file cache, list of missing URLs and pool of open files are
+// used by all of the servers.
+class WwwServerConfig
+{
+public:
+  WwwServerConfig(const char* iniFilename);
+
+  const char* getFilename(void) const;
+  boolean isLoaded(void) const;
+
+  // See the WwwServer functions of the same names. Changes apply to
+  // every server using this configuration.
+  void setFileCache(char* arena, int len,
+		    uint16_t maxFileSize = WWW_FILE_CACHE_MAX_FILE_SIZE);
+  void fileModified(const char* filename);
+  void mediaChanged(void);
+
+private:
+  friend class WwwServer;
+
+  // Settings read from URL sections of the ini file
+  typedef struct {
+    uint32_t sectionHash;
+    uint8_t flags; // which settings are present
+    int8_t priority;
+    uint8_t rateBurst; // number of requests allowed back to back
+    uint16_t rateInterval; // ms per request
+    uint8_t cacheDirectives; // WwwServer::cacheDirectiveNames flags
+    unsigned long cacheMaxAge; // s
+    unsigned long bandwidthLimit; // bytes/s
+  } policy_t;
+
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  // Client addresses allowed or denied for a URL section. Addresses
+  // are held with the first octet in the most significant byte.
+  typedef struct {
+    uint32_t address;
+    uint8_t prefixLen;
+    uint8_t policy; // index into _policies
+    boolean allow;
+  } hostRule_t;
+#endif
+
+  void clearMissing(void);
+  void closePooledFile(uint32_t fileHash);
+
+  const char* _filename;
+  // Shared by every server using this configuration. Each lookup
+  // opens the file and searches it to the end within one call, so no
+  // search state is kept here between calls.
+  IniFile _ini;
+  boolean _loaded;
+  policy_t _policies[WWW_SERVER_MAX_POLICIES];
+  uint8_t _numPolicies;
+#if WWW_SERVER_MAX_HOST_RULES > 0
+  hostRule_t _hostRules[WWW_SERVER_MAX_HOST_RULES];
+  uint8_t _numHostRules;
+#endif
+  WwwFileCache _fileCache;
+
+#if WWW_SERVER_MISS_CACHE_SIZE > 0
+  // URLs recently found not to exist
+  typedef struct {
+    uint32_t urlHash;
+    boolean errorDocument; // true if a 404 error document applies
+  } missing_t;
+  missing_t _missing[WWW_SERVER_MISS_CACHE_SIZE];
+  uint8_t _missingNext; // next entry to be replaced
+#endif
+
+#if WWW_SERVER_FILE_POOL_SIZE > 0
+  // Files kept open for reading
+  typedef struct {
+    uint32_t fileHash; // 0 when unused
+    uint16_t lastUsed;
+    File file;
+  } pooledFile_t;
+  pooledFile_t _filePool[WWW_SERVER_FILE_POOL_SIZE];
+  uint16_t _filePoolClock;
+#endif
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include <WwwTimeRange.h>
+
+WwwTimeRange::WwwTimeRange(void)
+{
+  _file = NULL;
+  _state = stateDone;
+  _size = _headerLen = _start = _end = 0;
+}
+
+void WwwTimeRange::start(File& file, const char* from, const char* to)
+{
+  _file = &file;
+  _from = (from && *from ? from : NULL);
+  _to = (to && *to ? to : NULL);
+  _size = file.size();
+  _headerLen = 0;
+  _start = _end = _size;
+  _state = stateHeader;
+}
+
+boolean WwwTimeRange::search(char* buffer, int len)
+{
+  unsigned long mid, rowStart;
+  int n;
+
+  switch (_state) {
+  case stateHeader:
+    // Find the end of the header line, reading a buffer at a time
+    if (!_file->seek(_headerLen) || (n = _file->read(buffer, len)) <= 0) {
+      _headerLen = _size;
+      _state = stateDone;
+      break;
+    }
+    for (int i = 0; i < n; ++i)
+      if (buffer[i] == '\n') {
+	_headerLen += i + 1;
+	_start = _headerLen;
+	if (_from) {
+	  startSearch(_from, _headerLen);
+	  _state = stateFrom;
+	}
+	else if (_to) {
+	  startSearch(_to, _headerLen);
+	  _state = stateTo;
+	}
+	else
+	  _state = stateDone;
+	return _state == stateDone;
+      }
+    _headerLen += n;
+    break;
+
+  case stateFrom:
+  case stateTo:
+    if (_lo >= _hi)
+      return endSearch();
+    mid = _lo + (_hi - _lo) / 2;
+    n = probe(buffer, len, mid, rowStart);
+    if (_state == stateFrom ? n >= 0 : n > 0) {
+      _hi = mid;
+      _found = rowStart;
+    }
+    else
+      _lo = rowStart + 1; // all offsets up to rowStart lead to this row
+    break;
+  }
+  return _state == stateDone;
+}
+
+unsigned long WwwTimeRange::getHeaderLength(void) const
+{
+  return _headerLen;
+}
+
+unsigned long WwwTimeRange::getStart(void) const
+{
+  return _start;
+}
+
+unsigned long WwwTimeRange::getEnd(void) const
+{
+  return _end;
+}
+
+void WwwTimeRange::startSearch(const char* key, unsigned long lo)
+{
+  _key = key;
+  _lo = lo;
+  _hi = _size;
+  _found = _size;
+}
+
+boolean WwwTimeRange::endSearch(void)
+{
+  if (_state == stateFrom) {
+    _start = _found;
+    if (_to) {
+      startSearch(_to, _start);
+      _state = stateTo;
+      return false;
+    }
+  }
+  else
+    _end = _found;
+  _state = stateDone;
+  return true;
+}
+
+// Find the first row starting at or after mid and compare its
+// timestamp with _key. Rows past the end of the file compare greater.
+int8_t WwwTimeRange::probe(char* buffer, int len, unsigned long mid,
+			   unsigned long& rowStart)
+{
+  unsigned long pos = mid;
+  int n = 0;
+  int i = 0;
+  --len; // room for a null terminator
+
+  if (mid > _headerLen) {
+    // Skip to the start of the next row, which may be at mid
+    pos = mid - 1;
+    while (true) {
+      if (!_file->seek(pos) || (n = _file->read(buffer, len)) <= 0) {
+	rowStart = _size;
+	return 1;
+      }
+      for (i = 0; i < n && buffer[i] != '\n'; ++i)
+	;
+      if (i < n)
+	break;
+      pos += n;
+    }
+    ++i;
+  }
+  rowStart = pos + i;
+  if (rowStart >= _size)
+    return 1;
+
+  // Read the timestamp afresh unless it ends within the buffer
+  int j = i;
+  while (j < n && strchr(",;\t\r\n", buffer[j]) == NULL)
+    ++j;
+  if (j == n) {
+    if (!_file->seek(rowStart) || (n = _file->read(buffer, len)) <= 0) {
+      rowStart = _size;
+      return 1;
+    }
+    i = 0;
+  }
+  buffer[n] = '\0';
+
+  char *field = buffer + i;
+  while (*field == ' ' || *field == '"')
+    ++field;
+  char *cp = field;
+  while (*cp && strchr(",;\t\r\n\"", *cp) == NULL)
+    ++cp;
+  *cp = '\0';
+  return compare(field, _key);
+}
+
+int WwwTimeRange::compare(const char* field, const char* key)
+{
+  const char *cp = key;
+  while (isdigit(*cp))
+    ++cp;
+  if (*cp == '\0') {
+    unsigned long t = strtoul(field, NULL, 10);
+    unsigned long k = strtoul(key, NULL, 10);
+    return (t > k) - (t < k);
+  }
+  int c = strncmp(field, key, strlen(key));
+  return (c > 0) - (c < 0);
+}
@@ -0,0 +1,68 @@
+#ifndef WWWTIMERANGE_H
+#define WWWTIMERANGE_H
+
+#include <SD.h>
+
+// Find the rows of a CSV file whose first field lies between two
+// timestamps, without reading the whole file. The rows must be sorted
+// by timestamp and follow a single header line.
+//
+// Timestamps given as digits only are compared numerically (eg Unix
+// time), others as strings against the same number of leading
+// characters of the field, so that ISO 8601 dates work and to =
+// 2024-01-31 includes every row of that day.
+//
+// The first row at or after from, and the first row after to, are
+// found by binary search on file offsets. Each probe seeks to an
+// offset, skips to the start of the next row and reads its timestamp.
+class WwwTimeRange
+{
+public:
+  WwwTimeRange(void);
+
+  // from and to may be NULL for an open range, and must remain valid
+  // until the search has finished
+  void start(File& file, const char* from, const char* to);
+
+  // Make one probe, using buffer for reading the file. Returns true
+  // once the range has been found.
+  boolean search(char* buffer, int len);
+
+  // The header line is bytes 0 to getHeaderLength()-1, the rows are
+  // bytes getStart() to getEnd()-1
+  unsigned long getHeaderLength(void) const;
+  unsigned long getStart(void) const;
+  unsigned long getEnd(void) const;
+
+private:
+  enum {
+    stateHeader,
+    stateFrom,
+    stateTo,
+    stateDone,
+  };
+
+  void startSearch(const char* key, unsigned long lo);
+  boolean endSearch(void);
+  int8_t probe(char* buffer, int len, unsigned long mid,
+	       unsigned long& rowStart);
+  static int compare(const char* field, const char* key);
+
+  File* _file;
+  const char* _from;
+  const char* _to;
+  const char* _key; // timestamp being searched for
+  uint8_t _state;
+  unsigned long _size;
+  unsigned long _headerLen;
+  unsigned long _start;
+  unsigned long _end;
+
+  // Search for the first row whose timestamp compares greater than
+  // _key (stateTo), or not less than _key (stateFrom)
+  unsigned long _lo;
+  unsigned long _hi;
+  unsigned long _found; // start of the row found at _hi
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include <WwwTopUrls.h>
+
+WwwTopUrls::WwwTopUrls(void)
+{
+  clear();
+}
+
+void WwwTopUrls::clear(void)
+{
+#if WWW_TOP_URLS_SIZE > 0
+  for (uint8_t i = 0; i < WWW_TOP_URLS_SIZE; ++i)
+    _entries[i].urlHash = 0;
+#endif
+}
+
+void WwwTopUrls::addRequest(uint32_t urlHash, const char* url)
+{
+#if WWW_TOP_URLS_SIZE > 0
+  entry_t *ep = find(urlHash);
+  if (ep) {
+    ++ep->requests;
+    return;
+  }
+
+  // Take an unused entry, or replace the one with the fewest requests
+  ep = &_entries[0];
+  for (uint8_t i = 0; i < WWW_TOP_URLS_SIZE; ++i) {
+    if (_entries[i].urlHash == 0) {
+      ep = &_entries[i];
+      ep->requests = 0;
+      break;
+    }
+    if (_entries[i].requests < ep->requests)
+      ep = &_entries[i];
+  }
+  ep->urlHash = urlHash;
+  ep->error = ep->requests;
+  ++ep->requests;
+  ep->bytes = 0;
+  ep->time = 0;
+  strncpy(ep->name, url, WWW_TOP_URLS_NAME_LEN);
+  ep->name[WWW_TOP_URLS_NAME_LEN] = '\0';
+#endif
+}
+
+void WwwTopUrls::addUsage(uint32_t urlHash, unsigned long bytes,
+			  unsigned long time)
+{
+  entry_t *ep = find(urlHash);
+  if (ep) {
+    ep->bytes += bytes;
+    ep->time += time;
+  }
+}
+
+const WwwTopUrls::entry_t* WwwTopUrls::getEntry(uint8_t rank) const
+{
+#if WWW_TOP_URLS_SIZE > 0
+  // Rank by selection, ties broken by position in the table
+  for (uint8_t i = 0; i < WWW_TOP_URLS_SIZE; ++i) {
+    const entry_t *ep = &_entries[i];
+    if (ep->urlHash == 0)
+      continue;
+    uint8_t above = 0;
+    for (uint8_t j = 0; j < WWW_TOP_URLS_SIZE; ++j)
+      if (_entries[j].urlHash &&
+	  (_entries[j].requests > ep->requests ||
+	   (_entries[j].requests == ep->requests && j < i)))
+	++above;
+    if (above == rank)
+      return ep;
+  }
+#endif
+  return NULL;
+}
+
+WwwTopUrls::entry_t* WwwTopUrls::find(uint32_t urlHash)
+{
+#if WWW_TOP_URLS_SIZE > 0
+  for (uint8_t i = 0; i < WWW_TOP_URLS_SIZE; ++i)
+    if (_entries[i].urlHash == urlHash && urlHash)
+      return &_entries[i];
+#endif
+  return NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef WWWTOPURLS_H
+#define WWWTOPURLS_H
+
+// Number of URLs tracked. Set to 0 to disable.
+#define WWW_TOP_URLS_SIZE 8
+
+// URLs are shown truncated to this length
+#define WWW_TOP_URLS_NAME_LEN 12
+
+#include <Arduino.h>
+
+// Find the most requested URLs in fixed memory, using the space-saving
+// algorithm. A URL which is not tracked replaces the entry with the
+// fewest requests and inherits its count, so counts may be too high
+// by up to the error recorded for the entry, but any URL requested
+// more often than 1 in WWW_TOP_URLS_SIZE times is always tracked.
+// Bytes sent and service time are only counted whilst the URL is
+// tracked.
+class WwwTopUrls
+{
+public:
+  typedef struct {
+    uint32_t urlHash; // 0 when unused
+    unsigned long requests;
+    unsigned long error; // requests which may belong to other URLs
+    unsigned long bytes;
+    unsigned long time; // ms
+    char name[WWW_TOP_URLS_NAME_LEN + 1];
+  } entry_t;
+
+  WwwTopUrls(void);
+  void clear(void);
+
+  // Count a request when it starts, and its cost when it ends
+  void addRequest(uint32_t urlHash, const char* url);
+  void addUsage(uint32_t urlHash, unsigned long bytes, unsigned long time);
+
+  // Entries in order of decreasing requests. Returns NULL after the
+  // last.
+  const entry_t* getEntry(uint8_t rank) const;
+
+private:
+  entry_t* find(uint32_t urlHash);
+
+#if WWW_TOP_URLS_SIZE > 0
+  entry_t _entries[WWW_TOP_URLS_SIZE];
+#endif
+};
+
+#endif
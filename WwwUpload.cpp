@@ -0,0 +1,340 @@
+#include <WwwUpload.h>
+#include <WwwServerConfig.h>
+
+WwwUpload::WwwUpload(void)
+{
+  _callback = NULL;
+  begin(NULL, 0);
+}
+
+void WwwUpload::begin(char* buffer, int len)
+{
+  const int fixed = (WWW_UPLOAD_MAX_BOUNDARY_LEN + 5) +
+    (WWW_UPLOAD_MAX_NAME_LEN + 1) + (WWW_UPLOAD_MAX_LINE_LEN + 1) +
+    (WWW_UPLOAD_MAX_PATH_LEN + 1);
+  if (buffer == NULL || len <= fixed) {
+    _delimiter = NULL;
+    _name = NULL;
+    _line = NULL;
+    _path = NULL;
+    _staging = NULL;
+    _stagingLen = 0;
+  }
+  else {
+    _delimiter = buffer;
+    _name = _delimiter + WWW_UPLOAD_MAX_BOUNDARY_LEN + 5;
+    _line = _name + WWW_UPLOAD_MAX_NAME_LEN + 1;
+    _path = _line + WWW_UPLOAD_MAX_LINE_LEN + 1;
+    _staging = _path + WWW_UPLOAD_MAX_PATH_LEN + 1;
+    _stagingLen = len - fixed;
+    if (_stagingLen > WWW_UPLOAD_SECTOR_SIZE)
+      _stagingLen -= _stagingLen % WWW_UPLOAD_SECTOR_SIZE;
+  }
+  _config = NULL;
+  _directory = NULL;
+  _lineLen = 0;
+  _staged = 0;
+  reset();
+}
+
+boolean WwwUpload::isEnabled(void) const
+{
+  return _delimiter != NULL;
+}
+
+void WwwUpload::setFieldCallback(field_t callback)
+{
+  _callback = callback;
+}
+
+char* WwwUpload::getHeaderBuffer(int& len)
+{
+  if (_line == NULL) {
+    len = 0;
+    return NULL;
+  }
+  // The path is not in use until the body is read
+  len = (WWW_UPLOAD_MAX_LINE_LEN + 1) + (WWW_UPLOAD_MAX_PATH_LEN + 1) +
+    _stagingLen;
+  return _line;
+}
+
+void WwwUpload::reset(void)
+{
+  if (_delimiter)
+    _delimiter[0] = '\0';
+  _haveLength = false;
+  _remaining = 0;
+  _state = stateDone;
+}
+
+// Extract the boundary from a Content-Type value such as
+// multipart/form-data; boundary="abc"
+boolean WwwUpload::setContentType(const char* contentType)
+{
+  const char multipart[] = "multipart/form-data";
+  if (_delimiter == NULL ||
+      strncasecmp(contentType, multipart, sizeof(multipart) - 1) != 0)
+    return false;
+  strcpy(_delimiter, "\r\n--");
+  if (!getParameter(contentType, "boundary", _delimiter + 4,
+		    WWW_UPLOAD_MAX_BOUNDARY_LEN + 1) ||
+      _delimiter[4] == '\0') {
+    _delimiter[0] = '\0';
+    return false;
+  }
+  return true;
+}
+
+void WwwUpload::setContentLength(unsigned long contentLength)
+{
+  _remaining = contentLength;
+  _haveLength = true;
+}
+
+boolean WwwUpload::isReady(void) const
+{
+  return _delimiter && _delimiter[0] && _haveLength;
+}
+
+void WwwUpload::start(WwwServerConfig& config, const char* directory)
+{
+  _config = &config;
+  _directory = directory;
+  _state = statePreamble;
+  // The body starts with a delimiter without the leading CRLF
+  _matched = 2;
+  _filesSaved = 0;
+  _result = uploadContinue;
+}
+
+unsigned long WwwUpload::getRemaining(void) const
+{
+  return _remaining;
+}
+
+int8_t WwwUpload::process(const char* data, int len)
+{
+  while (len-- > 0 && _remaining && _state != stateError) {
+    char c = *data++;
+    --_remaining;
+    switch (_state) {
+    case statePreamble:
+    case stateFile:
+    case stateField:
+    case stateSkip:
+      matchDelimiter(c);
+      break;
+
+    case stateAfterDelimiter:
+      // Either "--" for the final delimiter, or optional whitespace
+      // and CRLF before the next part's headers
+      if (c == '-') {
+	if (++_dashes == 2)
+	  _state = stateDone;
+      }
+      else if (c == '\n') {
+	_state = stateHeaders;
+	_lineLen = 0;
+	_name[0] = '\0';
+      }
+      break;
+
+    case stateHeaders:
+      if (c == '\r')
+	break;
+      if (c != '\n') {
+	if (_lineLen < WWW_UPLOAD_MAX_LINE_LEN)
+	  _line[_lineLen++] = c;
+	break;
+      }
+      if (_lineLen) {
+	_line[_lineLen] = '\0';
+	parseHeader();
+	_lineLen = 0;
+	break;
+      }
+      // End of headers
+      if (_file)
+	_state = stateFile;
+      else if (_name[0])
+	_state = stateField;
+      else
+	_state = stateSkip;
+      _matched = 0;
+      _staged = 0;
+      _lineLen = 0;
+      break;
+
+    case stateDone:
+      break; // ignore the epilogue
+    }
+  }
+
+  if (_state == stateError) {
+    abort();
+    return _result;
+  }
+  if (_remaining == 0) {
+    if (_state == stateDone)
+      return uploadDone;
+    abort(); // body ended early
+    return uploadBadRequest;
+  }
+  return uploadContinue;
+}
+
+void WwwUpload::abort(void)
+{
+  if (_file) {
+    _file.close();
+    SD.remove(_path);
+  }
+  _state = stateDone;
+}
+
+uint8_t WwwUpload::getFilesSaved(void) const
+{
+  return _filesSaved;
+}
+
+void WwwUpload::matchDelimiter(char c)
+{
+  if (c == _delimiter[_matched]) {
+    if (_delimiter[++_matched] == '\0') {
+      endPart();
+      _matched = 0;
+      _dashes = 0;
+      if (_state != stateError)
+	_state = stateAfterDelimiter;
+    }
+    return;
+  }
+
+  // The partial match was data after all
+  for (uint8_t i = 0; i < _matched; ++i)
+    emit(_delimiter[i]);
+  _matched = 0;
+  if (c == '\r')
+    _matched = 1;
+  else
+    emit(c);
+}
+
+void WwwUpload::emit(char c)
+{
+  switch (_state) {
+  case stateFile:
+    _staging[_staged++] = c;
+    if (_staged == _stagingLen && !writeStaged()) {
+      _result = uploadFileError;
+      _state = stateError;
+    }
+    break;
+
+  case stateField:
+    // Values which are too long are truncated
+    if (_lineLen < WWW_UPLOAD_MAX_LINE_LEN)
+      _line[_lineLen++] = c;
+    break;
+  }
+}
+
+void WwwUpload::endPart(void)
+{
+  switch (_state) {
+  case stateFile:
+    if (!writeStaged()) {
+      _result = uploadFileError;
+      _state = stateError;
+      return;
+    }
+    _file.close();
+    ++_filesSaved;
+    _config->fileModified(_path);
+    break;
+
+  case stateField:
+    _line[_lineLen] = '\0';
+    if (_callback)
+      (*_callback)(_name, _line);
+    break;
+  }
+}
+
+void WwwUpload::parseHeader(void)
+{
+  const char disposition[] = "Content-Disposition:";
+  if (strncasecmp(_line, disposition, sizeof(disposition) - 1) != 0)
+    return;
+
+  if (!getParameter(_line, "name", _name, WWW_UPLOAD_MAX_NAME_LEN + 1))
+    _name[0] = '\0';
+  // The staging area is not in use between parts
+  if (getParameter(_line, "filename", _staging, _stagingLen) &&
+      _staging[0] && !openFile(_staging)) {
+    _result = uploadFileError;
+    _state = stateError;
+  }
+}
+
+// Open directory/filename for writing, replacing any existing file.
+// Browsers may send a full path, only the final part is used.
+boolean WwwUpload::openFile(const char* filename)
+{
+  const char *cp = filename + strlen(filename);
+  while (cp > filename && cp[-1] != '/' && cp[-1] != '\\')
+    --cp;
+  if (*cp == '\0' || strcmp(cp, ".") == 0 || strcmp(cp, "..") == 0)
+    return false;
+
+  int dirLen = strlen(_directory);
+  boolean slash = (dirLen == 0 || _directory[dirLen-1] != '/');
+  if (dirLen + slash + strlen(cp) > WWW_UPLOAD_MAX_PATH_LEN)
+    return false;
+  strcpy(_path, _directory);
+  if (slash)
+    strcat(_path, "/");
+  strcat(_path, cp);
+
+  SD.remove(_path);
+  _file = SD.open(_path, FILE_WRITE);
+  return _file;
+}
+
+boolean WwwUpload::writeStaged(void)
+{
+  int n = _staged;
+  _staged = 0;
+  return n == 0 || _file.write((const uint8_t*)_staging, n) == (size_t)n;
+}
+
+// Find name=value in a header such as Content-Disposition, removing
+// any quotes from value. Returns false if not present or too long.
+boolean WwwUpload::getParameter(const char* header, const char* name,
+				char* value, int len)
+{
+  int nameLen = strlen(name);
+  const char *cp = strchr(header, ';');
+  while (cp) {
+    ++cp;
+    while (*cp == ' ' || *cp == '\t')
+      ++cp;
+    if (strncasecmp(cp, name, nameLen) == 0 && cp[nameLen] == '=') {
+      cp += nameLen + 1;
+      char end = ';';
+      if (*cp == '"')
+	end = *cp++;
+      int i = 0;
+      while (*cp && *cp != end) {
+	if (i >= len - 1)
+	  return false;
+	value[i++] = *cp++;
+      }
+      value[i] = '\0';
+      return true;
+    }
+    cp = strchr(cp, ';');
+  }
+  return false;
+}
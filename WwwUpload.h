@@ -0,0 +1,118 @@
+#ifndef WWWUPLOAD_H
+#define WWWUPLOAD_H
+
+// Longest multipart boundary allowed by RFC 2046
+#define WWW_UPLOAD_MAX_BOUNDARY_LEN 70
+
+// Longest form field name which is passed to the callback
+#define WWW_UPLOAD_MAX_NAME_LEN 16
+
+// Longest part header line or form field value
+#define WWW_UPLOAD_MAX_LINE_LEN 96
+
+// Longest path of a saved file
+#define WWW_UPLOAD_MAX_PATH_LEN 96
+
+// Writes to the SD card are this size when the buffer allows
+#define WWW_UPLOAD_SECTOR_SIZE 512
+
+#include <SD.h>
+
+class WwwServerConfig;
+
+// Parser for multipart/form-data request bodies. Data is passed in as
+// it arrives, in pieces of any size. Parts which have a filename are
+// written to the SD card, other parts are passed to a callback as
+// form fields.
+//
+// The delimiter is "\r\n--" followed by the boundary. Boundaries
+// cannot contain '\r' so a partial match can only restart at a '\r';
+// the bytes of a failed match are known to be the start of the
+// delimiter, so no data has to be held back whilst searching.
+class WwwUpload
+{
+public:
+  typedef void (*field_t)(const char* name, const char* value);
+
+  enum {
+    uploadFileError = -2,
+    uploadBadRequest = -1,
+    uploadContinue = 0,
+    uploadDone = 1,
+  };
+
+  WwwUpload(void);
+
+  // The buffer holds the boundary, part headers, field values and
+  // file data waiting to be written. Make it at least 800 bytes so
+  // that file data is written in whole sectors.
+  void begin(char* buffer, int len);
+  boolean isEnabled(void) const;
+  void setFieldCallback(field_t callback);
+
+  // Space for reading request header lines, which can be longer than
+  // the request buffer. Only valid until start() is called, and NULL
+  // if uploads are not enabled.
+  char* getHeaderBuffer(int& len);
+
+  // Call with the request's Content-Type and Content-Length values
+  // before start()
+  void reset(void);
+  boolean setContentType(const char* contentType);
+  void setContentLength(unsigned long contentLength);
+  boolean isReady(void) const;
+
+  // Save files in directory, which must remain valid until the upload
+  // ends
+  void start(WwwServerConfig& config, const char* directory);
+  unsigned long getRemaining(void) const;
+  int8_t process(const char* data, int len);
+  // Close and remove any partly written file
+  void abort(void);
+
+  uint8_t getFilesSaved(void) const;
+
+private:
+  enum {
+    statePreamble,
+    stateAfterDelimiter,
+    stateHeaders,
+    stateFile,
+    stateField,
+    stateSkip,
+    stateDone,
+    stateError,
+  };
+
+  void matchDelimiter(char c);
+  void emit(char c);
+  void endPart(void);
+  void parseHeader(void);
+  boolean openFile(const char* filename);
+  boolean writeStaged(void);
+  static boolean getParameter(const char* header, const char* name,
+			      char* value, int len);
+
+  char* _delimiter; // "\r\n--" then the boundary
+  char* _name;
+  char* _line;
+  char* _path; // file being written
+  char* _staging;
+  int _stagingLen;
+  field_t _callback;
+
+  WwwServerConfig* _config;
+  const char* _directory;
+  unsigned long _remaining;
+  boolean _haveLength;
+  uint8_t _state;
+  uint8_t _matched; // characters of _delimiter matched
+  uint8_t _dashes;
+  int _lineLen;
+  int _staged;
+  uint8_t _filesSaved;
+  int8_t _result; // error to return from process()
+  File _file;
+};
+
+#endif
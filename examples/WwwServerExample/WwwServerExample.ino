@@ -34,6 +34,21 @@ WwwServer www("/www.ini", port);
 const int bufferLen = 80; 
 char buffer[bufferLen];
 
+// Optional RAM cache for small, frequently requested files. Remove
+// this if RAM is short.
+const int fileCacheLen = 256;
+char fileCache[fileCacheLen];
+
+// Events sent to clients of /events
+const int eventBufferLen = 128;
+char eventBuffer[eventBufferLen];
+
+// Print the value for <!--#var uptime--> in files under /live
+void printUptime(Print& out)
+{
+  out.print(millis() / 1000);
+}
+
 void setup(void)
 {
   Serial.begin(9600);
@@ -71,6 +86,17 @@ void setup(void)
 
   if (!www.begin(buffer,  bufferLen))
     Serial.println("www.begin() failed");
+  www.setFileCache(fileCache, fileCacheLen, 128);
+  www.setEventBuffer(eventBuffer, eventBufferLen);
+  www.addIncludeVariable("uptime", printUptime);
+
+  // Hold one connection which arrives whilst the server is busy, and
+  // answer any more with 503 Service Unavailable, except for high
+  // priority URLs.
+  www.setAdmissionPolicy(3, 1);
+
+  // Only check for new connections every 10ms when idle
+  www.setIdlePollInterval(10000);
 
 }
 
@@ -88,14 +114,18 @@ void loop(void)
   // inifile short, with few comments and by structuring the SD file
   // system to avoid too many files in one direcotry, whilst
   // minimising the number of directories which must be searched.
-  www.processRequest(buffer,  bufferLen);
+  // When idle the server only needs to run every few milliseconds,
+  // getWakeDelay() says how long the sketch may do other things (or
+  // sleep) before calling processRequest() again.
+  if (www.isWorkPending())
+    www.processRequest(buffer,  bufferLen);
 
   // print some statistics to the serial console every 20s
   unsigned long now = millis();
   if (now > lastStatsTime + 20000) {
     lastStatsTime = now;
     WwwServer::stats_t stats;
-    const WwwServer::stats_t *sp = www.getStats();
+    www.getStats(stats);
     Serial.print("Statistics for to http://");
     Serial.print(Ethernet.localIP());
     if (port != 80) {
@@ -105,9 +135,20 @@ void loop(void)
     Serial.println('/');
 
     Serial.print("Number of requests: ");
-    Serial.println(sp->requestCount);
+    Serial.println(stats.requestCount);
     Serial.print("Longest duration of task: ");
-    Serial.print(sp->requestTimeWorstCase);
+    Serial.print(stats.requestTimeWorstCase);
     Serial.println(" us");
+
+    // Worst case since the last report
+    www.getStats(stats, WwwServer::statsCurrentWindow);
+    www.startStatsWindow();
+    Serial.print("Longest duration of task in last 20s: ");
+    Serial.print(stats.taskTimeWorstCase);
+    Serial.println(" us");
+
+    char uptime[12];
+    ultoa(now / 1000, uptime, 10);
+    www.publishEvent(uptime, "uptime");
   }
 }
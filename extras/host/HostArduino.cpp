@@ -0,0 +1,283 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include "HostModel.h"
+
+// Virtual clock, us
+static uint64_t now = 0;
+// Added to the clock for micros() and millis()
+static uint32_t microsOffset = 0;
+static uint32_t millisOffset = 0;
+
+hostCosts_t hostCosts;
+hostCounters_t hostCounters;
+
+void hostDefaultCosts(void)
+{
+  hostCosts.spiTransaction = 12;
+  hostCosts.spiBytesPerMs = 400;
+  hostCosts.sdBlockRead = 1400;
+  hostCosts.sdBlockWrite = 2200;
+  hostCosts.sdDirEntry = 4;
+  hostCosts.sdCall = 8;
+  hostCosts.clientBytesPerMs = 1000;
+}
+
+void hostZeroCosts(void)
+{
+  memset(&hostCosts, 0, sizeof(hostCosts));
+  hostCosts.clientBytesPerMs = 1000;
+}
+
+void hostClearCounters(void)
+{
+  memset(&hostCounters, 0, sizeof(hostCounters));
+}
+
+uint64_t hostTime(void)
+{
+  return now;
+}
+
+void hostSetTime(uint64_t us)
+{
+  now = us;
+}
+
+void hostSetClocks(uint32_t us, uint32_t ms)
+{
+  microsOffset = us - (uint32_t)now;
+  millisOffset = ms - (uint32_t)(now / 1000);
+}
+
+void hostAdvance(unsigned long us)
+{
+  now += us;
+}
+
+void hostCharge(unsigned long us)
+{
+  now += us;
+}
+
+uint32_t micros(void)
+{
+  return microsOffset + (uint32_t)now;
+}
+
+uint32_t millis(void)
+{
+  return millisOffset + (uint32_t)(now / 1000);
+}
+
+void delay(unsigned long ms)
+{
+  now += (uint64_t)ms * 1000;
+}
+
+void noInterrupts(void)
+{
+}
+
+void interrupts(void)
+{
+}
+
+// Print
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::printNumber(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2)
+    base = 10;
+  do {
+    unsigned long m = n;
+    n /= base;
+    char c = m - base * n;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::print(const char s[])
+{
+  return write(s);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == 10 && n < 0)
+    return print('-') + printNumber(-(unsigned long)n, 10);
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return printNumber(n, base);
+}
+
+size_t Print::print(const Printable& p)
+{
+  return p.printTo(*this);
+}
+
+size_t Print::println(void)
+{
+  return write("\r\n");
+}
+
+size_t Print::println(const char s[])
+{
+  return print(s) + println();
+}
+
+size_t Print::println(char c)
+{
+  return print(c) + println();
+}
+
+size_t Print::println(unsigned char n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t Print::println(int n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t Print::println(unsigned int n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t Print::println(long n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t Print::println(unsigned long n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t Print::println(const Printable& p)
+{
+  return print(p) + println();
+}
+
+// Serial output is discarded unless HOST_SERIAL is set in the
+// environment
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud)
+{
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  static int enabled = -1;
+  if (enabled == -1)
+    enabled = (getenv("HOST_SERIAL") != NULL);
+  if (enabled)
+    putchar(c);
+  return 1;
+}
+
+int HardwareSerial::available(void)
+{
+  return 0;
+}
+
+int HardwareSerial::read(void)
+{
+  return -1;
+}
+
+int HardwareSerial::peek(void)
+{
+  return -1;
+}
+
+void HardwareSerial::flush(void)
+{
+}
+
+// IPAddress
+
+IPAddress::IPAddress(void)
+{
+  memset(_address, 0, sizeof(_address));
+}
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+  _address[0] = a;
+  _address[1] = b;
+  _address[2] = c;
+  _address[3] = d;
+}
+
+// As the Arduino core, the first octet is the least significant byte
+IPAddress::IPAddress(uint32_t address)
+{
+  for (int i = 0; i < 4; ++i)
+    _address[i] = address >> (8 * i);
+}
+
+IPAddress::operator uint32_t() const
+{
+  return (uint32_t)_address[0] | ((uint32_t)_address[1] << 8) |
+    ((uint32_t)_address[2] << 16) | ((uint32_t)_address[3] << 24);
+}
+
+uint8_t IPAddress::operator[](int index) const
+{
+  return _address[index];
+}
+
+bool IPAddress::operator==(const IPAddress& other) const
+{
+  return memcmp(_address, other._address, sizeof(_address)) == 0;
+}
+
+size_t IPAddress::printTo(Print& p) const
+{
+  size_t n = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (i)
+      n += p.print('.');
+    n += p.print(_address[i], DEC);
+  }
+  return n;
+}
@@ -0,0 +1,361 @@
+// Simulated W5100. Each call into the library is charged as an SPI
+// transaction, and data as it is transferred. Every socket has a 2KB
+// transmit buffer which the client empties at clientBytesPerMs; as
+// with the Ethernet library, writing more than will fit waits for
+// space.
+
+#include <Ethernet.h>
+#include <vector>
+#include "HostModel.h"
+
+#define TX_BUFFER_SIZE 2048
+
+// Socket status, as the W5100
+#define SOCK_CLOSED 0x00
+#define SOCK_ESTABLISHED 0x17
+#define SOCK_CLOSE_WAIT 0x1C
+
+typedef struct {
+  uint16_t port;
+  std::string request;
+  size_t pieceLen;
+  unsigned long interval;
+  uint64_t connectedAt;
+  size_t readPos;
+  uint32_t address;
+  boolean clientClosed;
+  boolean serverClosed;
+  boolean stalled;
+  std::string response;
+  size_t txQueued; // bytes in the transmit buffer
+  uint64_t txUpdated;
+  int sock;
+} conn_t;
+
+static std::vector<conn_t> conns;
+static int sockets[MAX_SOCK_NUM]; // connection using each socket, or -1
+static boolean socketsInitialised = false;
+
+EthernetClass Ethernet;
+
+static void initSockets(void)
+{
+  if (!socketsInitialised) {
+    for (int i = 0; i < MAX_SOCK_NUM; ++i)
+      sockets[i] = -1;
+    socketsInitialised = true;
+  }
+}
+
+void hostResetSockets(void)
+{
+  socketsInitialised = false;
+  initSockets();
+  conns.clear();
+}
+
+static void spi(size_t bytes = 0)
+{
+  ++hostCounters.spiTransactions;
+  hostCounters.spiBytes += bytes;
+  unsigned long t = hostCosts.spiTransaction;
+  if (hostCosts.spiBytesPerMs)
+    t += bytes * 1000 / hostCosts.spiBytesPerMs;
+  hostCharge(t);
+}
+
+static conn_t* connFor(uint8_t sock)
+{
+  initSockets();
+  if (sock >= MAX_SOCK_NUM || sockets[sock] == -1)
+    return NULL;
+  return &conns[sockets[sock]];
+}
+
+// Bytes of the request the client has sent by now
+static size_t arrived(const conn_t* cp)
+{
+  if (cp->pieceLen == 0 || cp->interval == 0)
+    return cp->request.size();
+  uint64_t pieces = 1 + (hostTime() - cp->connectedAt) / cp->interval;
+  uint64_t n = pieces * cp->pieceLen;
+  return n < cp->request.size() ? n : cp->request.size();
+}
+
+static void drain(conn_t* cp)
+{
+  uint64_t now = hostTime();
+  if (!cp->stalled) {
+    uint64_t n = (now - cp->txUpdated) * hostCosts.clientBytesPerMs / 1000;
+    cp->txQueued = (n >= cp->txQueued ? 0 : cp->txQueued - n);
+  }
+  cp->txUpdated = now;
+}
+
+// Host interface
+
+int hostConnect(uint16_t port, const std::string& request,
+		uint32_t address, size_t pieceLen, unsigned long interval)
+{
+  initSockets();
+  conn_t c;
+  c.port = port;
+  c.request = request;
+  c.pieceLen = pieceLen;
+  c.interval = interval;
+  c.connectedAt = hostTime();
+  c.readPos = 0;
+  c.address = address;
+  c.clientClosed = false;
+  c.serverClosed = true; // refused unless a socket is free
+  c.stalled = false;
+  c.txQueued = 0;
+  c.txUpdated = hostTime();
+  c.sock = -1;
+  for (int i = 0; i < MAX_SOCK_NUM; ++i)
+    if (sockets[i] == -1) {
+      c.sock = i;
+      c.serverClosed = false;
+      sockets[i] = conns.size();
+      break;
+    }
+  conns.push_back(c);
+  return conns.size() - 1;
+}
+
+void hostClientClose(int id)
+{
+  conns[id].clientClosed = true;
+}
+
+void hostSetClientStalled(int id, boolean stalled)
+{
+  drain(&conns[id]);
+  conns[id].stalled = stalled;
+}
+
+const std::string& hostResponse(int id)
+{
+  return conns[id].response;
+}
+
+boolean hostIsClosed(int id)
+{
+  return conns[id].serverClosed;
+}
+
+int hostOpenConnections(void)
+{
+  initSockets();
+  int n = 0;
+  for (int i = 0; i < MAX_SOCK_NUM; ++i)
+    n += (sockets[i] != -1);
+  return n;
+}
+
+// EthernetClient
+
+EthernetClient::EthernetClient(void) : _sock(MAX_SOCK_NUM)
+{
+}
+
+EthernetClient::EthernetClient(uint8_t sock) : _sock(sock)
+{
+}
+
+uint8_t EthernetClient::status(void)
+{
+  spi();
+  conn_t* cp = connFor(_sock);
+  if (cp == NULL)
+    return SOCK_CLOSED;
+  return cp->clientClosed ? SOCK_CLOSE_WAIT : SOCK_ESTABLISHED;
+}
+
+size_t EthernetClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t EthernetClient::write(const uint8_t* buffer, size_t size)
+{
+  conn_t* cp = connFor(_sock);
+  spi(size);
+  if (cp == NULL)
+    return 0;
+  drain(cp);
+  if (cp->txQueued + size > TX_BUFFER_SIZE) {
+    // Wait for the client to take enough, or give up as the Ethernet
+    // library would when the connection times out
+    if (cp->stalled || hostCosts.clientBytesPerMs == 0) {
+      hostCharge(1000000UL);
+      size = TX_BUFFER_SIZE - cp->txQueued;
+    }
+    else
+      hostCharge((cp->txQueued + size - TX_BUFFER_SIZE) * 1000 /
+		 hostCosts.clientBytesPerMs + 1);
+    drain(cp);
+  }
+  cp->txQueued += size;
+  cp->response.append((const char*)buffer, size);
+  return size;
+}
+
+int EthernetClient::availableForWrite(void)
+{
+  spi();
+  conn_t* cp = connFor(_sock);
+  if (cp == NULL)
+    return 0;
+  drain(cp);
+  return TX_BUFFER_SIZE - cp->txQueued;
+}
+
+int EthernetClient::available(void)
+{
+  spi();
+  conn_t* cp = connFor(_sock);
+  if (cp == NULL)
+    return 0;
+  return arrived(cp) - cp->readPos;
+}
+
+int EthernetClient::read(uint8_t* buffer, size_t size)
+{
+  conn_t* cp = connFor(_sock);
+  size_t n = 0;
+  if (cp) {
+    n = arrived(cp) - cp->readPos;
+    if (n > size)
+      n = size;
+    memcpy(buffer, cp->request.data() + cp->readPos, n);
+    cp->readPos += n;
+  }
+  spi(n);
+  return n ? (int)n : -1;
+}
+
+int EthernetClient::read(void)
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int EthernetClient::peek(void)
+{
+  spi(1);
+  conn_t* cp = connFor(_sock);
+  if (cp == NULL || arrived(cp) == cp->readPos)
+    return -1;
+  return (uint8_t)cp->request[cp->readPos];
+}
+
+void EthernetClient::flush(void)
+{
+  conn_t* cp = connFor(_sock);
+  spi();
+  if (cp == NULL)
+    return;
+  drain(cp);
+  if (cp->txQueued && !cp->stalled && hostCosts.clientBytesPerMs) {
+    hostCharge(cp->txQueued * 1000 / hostCosts.clientBytesPerMs + 1);
+    drain(cp);
+  }
+}
+
+void EthernetClient::stop(void)
+{
+  conn_t* cp = connFor(_sock);
+  spi();
+  if (cp) {
+    cp->serverClosed = true;
+    sockets[_sock] = -1;
+  }
+  _sock = MAX_SOCK_NUM;
+}
+
+uint8_t EthernetClient::connected(void)
+{
+  conn_t* cp = connFor(_sock);
+  spi();
+  if (cp == NULL)
+    return 0;
+  if (cp->clientClosed)
+    return arrived(cp) > cp->readPos;
+  return 1;
+}
+
+EthernetClient::operator bool()
+{
+  return _sock < MAX_SOCK_NUM;
+}
+
+bool EthernetClient::operator==(const EthernetClient& other) const
+{
+  return _sock == other._sock && _sock < MAX_SOCK_NUM;
+}
+
+IPAddress EthernetClient::remoteIP(void)
+{
+  spi(4);
+  conn_t* cp = connFor(_sock);
+  if (cp == NULL)
+    return IPAddress();
+  uint32_t a = cp->address;
+  return IPAddress(a >> 24, a >> 16, a >> 8, a);
+}
+
+uint8_t EthernetClient::getSocketNumber(void) const
+{
+  return _sock;
+}
+
+// EthernetServer
+
+EthernetServer::EthernetServer(uint16_t port) : _port(port)
+{
+}
+
+void EthernetServer::begin(void)
+{
+  initSockets();
+}
+
+// As the Ethernet library, return the highest numbered socket with
+// data waiting, after checking the status of every socket
+EthernetClient EthernetServer::available(void)
+{
+  initSockets();
+  uint8_t sock = MAX_SOCK_NUM;
+  for (uint8_t i = 0; i < MAX_SOCK_NUM; ++i) {
+    spi();
+    if (sockets[i] == -1)
+      continue;
+    conn_t* cp = &conns[sockets[i]];
+    if (cp->port != _port)
+      continue;
+    spi();
+    if (arrived(cp) > cp->readPos)
+      sock = i;
+  }
+  return EthernetClient(sock);
+}
+
+size_t EthernetServer::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t EthernetServer::write(const uint8_t* buffer, size_t size)
+{
+  initSockets();
+  for (uint8_t i = 0; i < MAX_SOCK_NUM; ++i)
+    if (sockets[i] != -1 && conns[sockets[i]].port == _port)
+      EthernetClient(i).write(buffer, size);
+  return size;
+}
+
+IPAddress EthernetClass::localIP(void)
+{
+  return IPAddress(192, 168, 1, 10);
+}
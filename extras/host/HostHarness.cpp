@@ -0,0 +1,177 @@
+#include "HostHarness.h"
+
+// Must match up with the WwwServer state enum
+static const char* stateNames[HOST_NUM_STATES] = {
+  "NoClient",
+  "ReadingMethod",
+  "GettingHandlerSetUp",
+  "GettingHandler",
+  "CheckingPostSetUp",
+  "CheckingPost",
+  "ReadingHeaders",
+  "ReceivingPost",
+  "UrlToFilename",
+  "RedirectingToDirectory",
+  "FindingLocationSetUp",
+  "FindingLocation",
+  "FindingErrorDocumentSetUp",
+  "FindingErrorDocument",
+  "SendingStatusCode",
+  "RunningDefaultHandler",
+  "SendingFileMimeTypeSetUp",
+  "SendingFileMimeType",
+  "SendingDefaultMimeTypeSetUp",
+  "SendingDefaultMimeType",
+  "SendingFile",
+  "SendingCachedFile",
+  "SendingDirectoryListingHeader",
+  "SendingDirectoryListingBody",
+  "SendingDirectoryListingFooter",
+  "RunningStatusHandler",
+  "SubscribingEventStream",
+  "ClosingConnection",
+  "Disconnecting",
+};
+
+HostHarness::HostHarness(WwwServer& server, char* buffer, int len)
+  : _server(server), _buffer(buffer), _len(len), _loopTime(50),
+    _maxSleep(1000000UL)
+{
+  clear();
+}
+
+void HostHarness::setLoopTime(unsigned long us)
+{
+  _loopTime = us;
+}
+
+void HostHarness::setMaxSleep(unsigned long us)
+{
+  _maxSleep = us;
+}
+
+void HostHarness::clear(void)
+{
+  _calls = 0;
+  _busyTime = 0;
+  memset(_states, 0, sizeof(_states));
+}
+
+int8_t HostHarness::step(void)
+{
+  int8_t state = _server.getState();
+  hostCounters_t before = hostCounters;
+  uint64_t start = hostTime();
+  int8_t result = _server.processRequest(_buffer, _len);
+  unsigned long t = hostTime() - start;
+
+  // Idle calls which only polled for a client are not counted
+  if (state == WwwServer::stateNoClient &&
+      _server.getState() == WwwServer::stateNoClient)
+    return result;
+  ++_calls;
+  _busyTime += t;
+
+  hostStateStats_t& s = _states[state];
+  unsigned long spi = hostCounters.spiTransactions - before.spiTransactions;
+  unsigned long spiBytes = hostCounters.spiBytes - before.spiBytes;
+  unsigned long blocks = (hostCounters.sdBlockReads - before.sdBlockReads) +
+    (hostCounters.sdBlockWrites - before.sdBlockWrites);
+  unsigned long lines = hostCounters.iniLines - before.iniLines;
+  unsigned long lookups = hostCounters.iniLookups - before.iniLookups;
+  unsigned long entries = hostCounters.sdDirEntries - before.sdDirEntries;
+  unsigned long searches = hostCounters.sdSearches - before.sdSearches;
+  unsigned long ownBlocks = blocks -
+    (hostCounters.iniBlocks - before.iniBlocks) -
+    (hostCounters.sdSearchBlocks - before.sdSearchBlocks);
+  unsigned long own = t - (hostCounters.iniTime - before.iniTime) -
+    (hostCounters.sdSearchTime - before.sdSearchTime);
+  ++s.calls;
+  s.timeTotal += t;
+  if (t > s.timeWorstCase)
+    s.timeWorstCase = t;
+  if (own > s.ownTimeWorstCase)
+    s.ownTimeWorstCase = own;
+  if (ownBlocks > s.sdOwnBlocksWorstCase)
+    s.sdOwnBlocksWorstCase = ownBlocks;
+  if (searches > s.sdSearchesWorstCase)
+    s.sdSearchesWorstCase = searches;
+  if (entries > s.sdDirEntriesWorstCase)
+    s.sdDirEntriesWorstCase = entries;
+  if (lookups > s.iniLookupsWorstCase)
+    s.iniLookupsWorstCase = lookups;
+  if (spi > s.spiWorstCase)
+    s.spiWorstCase = spi;
+  if (spiBytes > s.spiBytesWorstCase)
+    s.spiBytesWorstCase = spiBytes;
+  if (blocks > s.sdBlocksWorstCase)
+    s.sdBlocksWorstCase = blocks;
+  if (lines > s.iniLinesWorstCase)
+    s.iniLinesWorstCase = lines;
+  return result;
+}
+
+// Sleep until the server next needs to run, as getWakeDelay() allows
+void HostHarness::wait(void)
+{
+  unsigned long d = _server.getWakeDelay();
+  if (d > _maxSleep)
+    d = _maxSleep;
+  hostAdvance(d > _loopTime ? d : _loopTime);
+}
+
+boolean HostHarness::runUntilClosed(int id, unsigned long timeout)
+{
+  uint64_t end = hostTime() + timeout;
+  while (hostTime() < end) {
+    step();
+    if (hostIsClosed(id))
+      return true;
+    wait();
+  }
+  return false;
+}
+
+boolean HostHarness::runUntilIdle(unsigned long timeout)
+{
+  uint64_t end = hostTime() + timeout;
+  while (hostTime() < end) {
+    step();
+    if (_server.getState() == WwwServer::stateNoClient &&
+	hostOpenConnections() == 0)
+      return true;
+    wait();
+  }
+  return false;
+}
+
+void HostHarness::runFor(unsigned long us)
+{
+  uint64_t end = hostTime() + us;
+  while (hostTime() < end) {
+    step();
+    wait();
+  }
+}
+
+const hostStateStats_t& HostHarness::getStateStats(int8_t state) const
+{
+  return _states[state];
+}
+
+unsigned long HostHarness::getCalls(void) const
+{
+  return _calls;
+}
+
+unsigned long HostHarness::getBusyTime(void) const
+{
+  return _busyTime;
+}
+
+const char* HostHarness::stateName(int8_t state)
+{
+  if (state < 0 || state >= HOST_NUM_STATES)
+    return "?";
+  return stateNames[state];
+}
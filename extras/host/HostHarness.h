@@ -0,0 +1,71 @@
+#ifndef HOSTHARNESS_H
+#define HOSTHARNESS_H
+
+// Drives a WwwServer as a sketch would, on the virtual clock, and
+// records how long each call to processRequest() took and what it
+// did, by the state the call started in.
+
+#include <WwwServer.h>
+#include "HostModel.h"
+
+#define HOST_NUM_STATES (WwwServer::stateDisconnecting + 1)
+
+typedef struct {
+  unsigned long calls;
+  unsigned long timeTotal; // us
+  unsigned long timeWorstCase;
+  // Time not spent in IniFile lookups or searching directories, the
+  // parts which grow with the ini file and the SD card's contents
+  unsigned long ownTimeWorstCase;
+  unsigned long spiWorstCase; // SPI transactions in one call
+  unsigned long spiBytesWorstCase;
+  unsigned long sdBlocksWorstCase; // blocks read or written
+  unsigned long sdOwnBlocksWorstCase; // as above, not counting lookups
+  unsigned long sdSearchesWorstCase; // files opened or checked
+  unsigned long sdDirEntriesWorstCase;
+  unsigned long iniLookupsWorstCase;
+  unsigned long iniLinesWorstCase;
+} hostStateStats_t;
+
+class HostHarness
+{
+public:
+  HostHarness(WwwServer& server, char* buffer, int len);
+
+  // Time (us) the rest of the sketch's loop takes between calls
+  void setLoopTime(unsigned long us);
+  // Longest time (us) to sleep when the server has nothing to do
+  void setMaxSleep(unsigned long us);
+
+  // One call to processRequest()
+  int8_t step(void);
+
+  // Call processRequest(), waiting between calls as getWakeDelay()
+  // allows, until connection id has been closed by the server.
+  // Returns false if that takes longer than timeout us.
+  boolean runUntilClosed(int id, unsigned long timeout = 60000000UL);
+  // As above until the server is idle, or for a time
+  boolean runUntilIdle(unsigned long timeout = 60000000UL);
+  void runFor(unsigned long us);
+
+  void clear(void);
+  const hostStateStats_t& getStateStats(int8_t state) const;
+  unsigned long getCalls(void) const; // calls which found work to do
+  unsigned long getBusyTime(void) const; // us spent in those calls
+
+  static const char* stateName(int8_t state);
+
+private:
+  void wait(void);
+
+  WwwServer& _server;
+  char* _buffer;
+  int _len;
+  unsigned long _loopTime;
+  unsigned long _maxSleep;
+  unsigned long _calls;
+  unsigned long _busyTime;
+  hostStateStats_t _states[HOST_NUM_STATES];
+};
+
+#endif
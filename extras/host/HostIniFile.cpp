@@ -0,0 +1,132 @@
+// IniFile lookups, reading the simulated card a line at a time in the
+// same way as the IniFile library: each lookup reopens the file and
+// searches it from the start.
+
+#include <IniFile.h>
+#include "HostModel.h"
+
+IniFileState::IniFileState(void)
+{
+}
+
+IniFile::IniFile(const char* filename, uint8_t mode)
+  : _filename(filename), _mode(mode)
+{
+}
+
+boolean IniFile::open(void)
+{
+  if (_file)
+    _file.close();
+  _file = SD.open(_filename, _mode);
+  return _file;
+}
+
+void IniFile::close(void)
+{
+  if (_file)
+    _file.close();
+}
+
+// Read the line starting at the current position into buffer, without
+// the line ending. Returns its length, -1 at the end of the file, or
+// errorBufferTooShort.
+int IniFile::readLine(char* buffer, int len)
+{
+  uint32_t pos = _file.position();
+  int n = _file.read(buffer, len - 1);
+  if (n <= 0)
+    return -1;
+  ++hostCounters.iniLines;
+  buffer[n] = '\0';
+  char* end = strpbrk(buffer, "\r\n");
+  if (end == NULL) {
+    if (_file.available())
+      return errorBufferTooShort;
+    end = buffer + n;
+  }
+  uint32_t next = pos + (end - buffer);
+  if (*end == '\r' && end[1] == '\n')
+    next += 2;
+  else if (*end)
+    ++next;
+  *end = '\0';
+  _file.seek(next);
+  return end - buffer;
+}
+
+static char* trim(char* s)
+{
+  while (isspace(*s))
+    ++s;
+  char* end = s + strlen(s);
+  while (end > s && isspace(end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+boolean IniFile::validate(char* buffer, int len)
+{
+  if (!_file)
+    return false;
+  _file.seek(0);
+  int n;
+  while ((n = readLine(buffer, len)) != -1)
+    if (n == errorBufferTooShort)
+      return false;
+  return true;
+}
+
+int8_t IniFile::getValue(const char* section, const char* key,
+			 char* buffer, int len)
+{
+  if (!_file)
+    return errorFileNotOpen;
+  ++hostCounters.iniLookups;
+  unsigned long lines = hostCounters.iniLines;
+  uint64_t start = hostTime();
+  unsigned long blocks = hostCounters.sdBlockReads;
+  int8_t result = errorSectionNotFound;
+  boolean inSection = false;
+  _file.seek(0);
+  int n;
+  while ((n = readLine(buffer, len)) != -1) {
+    if (n == errorBufferTooShort) {
+      result = errorBufferTooShort;
+      break;
+    }
+    char* s = trim(buffer);
+    if (*s == ';' || *s == '#' || *s == '\0')
+      continue;
+    if (*s == '[') {
+      if (inSection)
+	break; // key not in the section
+      char* end = strchr(++s, ']');
+      if (end) {
+	*end = '\0';
+	inSection = (strcasecmp(s, section) == 0);
+	if (inSection)
+	  result = errorKeyNotFound;
+      }
+      continue;
+    }
+    if (!inSection)
+      continue;
+    char* value = strpbrk(s, "=:");
+    if (value == NULL)
+      continue;
+    *value++ = '\0';
+    if (strcasecmp(trim(s), key) == 0) {
+      value = trim(value);
+      memmove(buffer, value, strlen(value) + 1);
+      result = 1;
+      break;
+    }
+  }
+  hostCounters.iniTime += hostTime() - start;
+  hostCounters.iniBlocks += hostCounters.sdBlockReads - blocks;
+  lines = hostCounters.iniLines - lines;
+  if (lines > hostCounters.iniLinesWorstCase)
+    hostCounters.iniLinesWorstCase = lines;
+  return result;
+}
@@ -0,0 +1,86 @@
+#ifndef HOSTMODEL_H
+#define HOSTMODEL_H
+
+// Simulated hardware for running WwwServer on a Linux host. Time is
+// virtual: it only moves when the stand-in libraries charge for an
+// operation, or when the harness advances it. The costs below are
+// rough figures for an ATmega with a W5100 and an SD card on a 4MHz
+// SPI bus; set them to 0 to count operations without any latency.
+
+#include <Arduino.h>
+#include <string>
+
+typedef struct {
+  unsigned long spiTransaction; // us per call into the Ethernet device
+  unsigned long spiBytesPerMs; // Ethernet data transfer rate
+  unsigned long sdBlockRead; // us to read a 512 byte block
+  unsigned long sdBlockWrite; // us to write a block
+  unsigned long sdDirEntry; // us to compare one directory entry
+  unsigned long sdCall; // us for any other SD library call
+  unsigned long clientBytesPerMs; // rate the client takes data
+} hostCosts_t;
+
+typedef struct {
+  unsigned long spiTransactions;
+  unsigned long spiBytes;
+  unsigned long sdBlockReads;
+  unsigned long sdBlockWrites;
+  unsigned long sdDirEntries;
+  unsigned long sdFlushes;
+  unsigned long sdOpens;
+  unsigned long iniLookups;
+  unsigned long iniLines; // lines read by IniFile lookups
+  unsigned long iniLinesWorstCase; // most lines read by one lookup
+  unsigned long iniTime; // us spent in IniFile lookups
+  unsigned long iniBlocks; // blocks read by IniFile lookups
+  unsigned long sdSearches; // paths looked up
+  unsigned long sdSearchTime; // us spent searching directories
+  unsigned long sdSearchBlocks; // directory blocks read
+} hostCounters_t;
+
+extern hostCosts_t hostCosts;
+extern hostCounters_t hostCounters;
+
+// Costs as described above, and counters set to zero
+void hostDefaultCosts(void);
+void hostZeroCosts(void);
+void hostClearCounters(void);
+
+// Virtual clock. hostTime() is the simulation's own time in us.
+// micros() and millis() follow it, rolling over at 32 bits as on the
+// hardware; hostSetClocks() sets what they read now, eg just before a
+// rollover.
+uint64_t hostTime(void);
+void hostSetTime(uint64_t us);
+void hostSetClocks(uint32_t us, uint32_t ms);
+void hostAdvance(unsigned long us);
+void hostCharge(unsigned long us); // time taken by a library call
+
+// Clear the SD card and close all connections
+void hostReset(void);
+
+// SD card contents. Directories are created as needed. Paths are
+// case-insensitive, as on FAT.
+void hostAddFile(const char* path, const std::string& data);
+void hostAddFile(const char* path, size_t size); // filled with text
+void hostAddDirectory(const char* path);
+boolean hostFileExists(const char* path);
+std::string hostReadFile(const char* path);
+
+// Client connections. The request arrives in pieces of pieceLen bytes
+// (0 for all at once) every interval us from now. Returns an id for
+// the functions below.
+int hostConnect(uint16_t port, const std::string& request,
+		uint32_t address = 0xC0A80102UL, size_t pieceLen = 0,
+		unsigned long interval = 0);
+// The client closes its end of the connection
+void hostClientClose(int id);
+// A stalled client stops taking data, so the transmit buffer fills
+void hostSetClientStalled(int id, boolean stalled);
+const std::string& hostResponse(int id);
+boolean hostIsClosed(int id); // closed by the server
+// Number of connections open, including ones the server has not
+// accepted yet
+int hostOpenConnections(void);
+
+#endif
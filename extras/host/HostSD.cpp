@@ -0,0 +1,492 @@
+// In-memory SD card. Like the SD library, the card has a single block
+// cache: reading or writing within the cached block is cheap, moving
+// to another block costs a block transfer, and writing back a
+// modified block another. Opening a file compares the entries of each
+// directory on its path in turn.
+
+#include <SD.h>
+#include <map>
+#include <memory>
+#include <vector>
+#include "HostModel.h"
+
+#define BLOCK_SIZE 512
+#define DIR_ENTRY_SIZE 32
+
+typedef struct Node {
+  std::string name; // as returned by File::name()
+  boolean isDir;
+  std::string data;
+  std::vector<std::string> children; // paths, in creation order
+} node_t;
+
+typedef std::shared_ptr<node_t> nodePtr;
+
+class HostOpenFile {
+public:
+  nodePtr node;
+  std::string path;
+  uint32_t pos;
+  uint8_t mode;
+  boolean open;
+  int refs;
+  size_t dirIndex;
+};
+
+SDClass SD;
+
+static std::map<std::string, nodePtr> files;
+
+// The block held in the cache
+static const node_t* cacheNode = NULL;
+static uint32_t cacheBlock = 0;
+static boolean cacheDirty = false;
+
+static void writeBack(void)
+{
+  if (cacheNode && cacheDirty) {
+    hostCharge(hostCosts.sdBlockWrite);
+    ++hostCounters.sdBlockWrites;
+  }
+  cacheDirty = false;
+}
+
+// Bring a block into the cache. A block which is about to be
+// completely overwritten, or which is past the end of the data, need
+// not be read.
+static void useBlock(const node_t* node, uint32_t block, boolean write,
+		     boolean whole)
+{
+  if (node != cacheNode || block != cacheBlock) {
+    writeBack();
+    cacheNode = node;
+    cacheBlock = block;
+    if (!(write && (whole || block * BLOCK_SIZE >= node->data.size()))) {
+      hostCharge(hostCosts.sdBlockRead);
+      ++hostCounters.sdBlockReads;
+    }
+  }
+  if (write)
+    cacheDirty = true;
+}
+
+static std::string normalise(const char* path)
+{
+  std::string s = "/";
+  for (const char* p = path; *p; ++p) {
+    if (*p == '/' && s[s.size() - 1] == '/')
+      continue;
+    s += toupper(*p);
+  }
+  if (s.size() > 1 && s[s.size() - 1] == '/')
+    s.erase(s.size() - 1);
+  return s;
+}
+
+static std::string parentOf(const std::string& path)
+{
+  size_t i = path.rfind('/');
+  return i == 0 ? "/" : path.substr(0, i);
+}
+
+static nodePtr root(void)
+{
+  nodePtr& r = files["/"];
+  if (!r) {
+    r.reset(new node_t);
+    r->name = "/";
+    r->isDir = true;
+  }
+  return r;
+}
+
+// Search each directory on the path, charging for the entries
+// compared. Returns NULL if not found.
+static nodePtr search(const std::string& path)
+{
+  nodePtr dir = root();
+  if (path == "/")
+    return dir;
+  size_t start = 1;
+  std::string sofar;
+  while (true) {
+    size_t end = path.find('/', start);
+    std::string part = sofar + "/" +
+      path.substr(start, end == std::string::npos ? std::string::npos :
+		  end - start);
+    size_t i;
+    for (i = 0; i < dir->children.size(); ++i) {
+      if (i % (BLOCK_SIZE / DIR_ENTRY_SIZE) == 0)
+	useBlock(dir.get(), i / (BLOCK_SIZE / DIR_ENTRY_SIZE), false, false);
+      hostCharge(hostCosts.sdDirEntry);
+      ++hostCounters.sdDirEntries;
+      if (dir->children[i] == part)
+	break;
+    }
+    if (i == dir->children.size())
+      return nodePtr();
+    nodePtr node = files[part];
+    if (end == std::string::npos)
+      return node;
+    if (!node->isDir)
+      return nodePtr();
+    dir = node;
+    sofar = part;
+    start = end + 1;
+  }
+}
+
+static nodePtr lookup(const std::string& path)
+{
+  uint64_t start = hostTime();
+  unsigned long blocks = hostCounters.sdBlockReads +
+    hostCounters.sdBlockWrites;
+  nodePtr node = search(path);
+  ++hostCounters.sdSearches;
+  hostCounters.sdSearchTime += hostTime() - start;
+  hostCounters.sdSearchBlocks += hostCounters.sdBlockReads +
+    hostCounters.sdBlockWrites - blocks;
+  return node;
+}
+
+static nodePtr create(const std::string& path, boolean isDir)
+{
+  nodePtr parent = files[parentOf(path)];
+  if (!parent || !parent->isDir)
+    return nodePtr();
+  nodePtr node(new node_t);
+  node->name = path.substr(path.rfind('/') + 1).substr(0, 12);
+  node->isDir = isDir;
+  parent->children.push_back(path);
+  files[path] = node;
+  useBlock(parent.get(), (parent->children.size() - 1) /
+	   (BLOCK_SIZE / DIR_ENTRY_SIZE), true, false);
+  return node;
+}
+
+static void unlink(const std::string& path)
+{
+  nodePtr parent = files[parentOf(path)];
+  for (size_t i = 0; i < parent->children.size(); ++i)
+    if (parent->children[i] == path) {
+      parent->children.erase(parent->children.begin() + i);
+      break;
+    }
+  if (cacheNode == files[path].get())
+    cacheNode = NULL;
+  files.erase(path);
+}
+
+// Host interface
+
+void hostReset(void)
+{
+  files.clear();
+  cacheNode = NULL;
+  cacheDirty = false;
+  root();
+  extern void hostResetSockets(void);
+  hostResetSockets();
+}
+
+void hostAddDirectory(const char* path)
+{
+  std::string p = normalise(path);
+  if (p == "/" || files.count(p))
+    return;
+  hostAddDirectory(parentOf(p).c_str());
+  create(p, true);
+}
+
+void hostAddFile(const char* path, const std::string& data)
+{
+  std::string p = normalise(path);
+  hostAddDirectory(parentOf(p).c_str());
+  nodePtr node = files.count(p) ? files[p] : create(p, false);
+  node->data = data;
+}
+
+void hostAddFile(const char* path, size_t size)
+{
+  std::string data;
+  data.reserve(size);
+  while (data.size() < size) {
+    char line[48];
+    snprintf(line, sizeof(line), "%08lu some text to fill a file\n",
+	     (unsigned long)data.size());
+    data += line;
+  }
+  data.resize(size);
+  hostAddFile(path, data);
+}
+
+boolean hostFileExists(const char* path)
+{
+  return files.count(normalise(path)) != 0;
+}
+
+std::string hostReadFile(const char* path)
+{
+  std::string p = normalise(path);
+  return files.count(p) ? files[p]->data : std::string();
+}
+
+// SDClass
+
+boolean SDClass::begin(uint8_t csPin)
+{
+  root();
+  return true;
+}
+
+File SDClass::open(const char* filename, uint8_t mode)
+{
+  hostCharge(hostCosts.sdCall);
+  ++hostCounters.sdOpens;
+  std::string p = normalise(filename);
+  nodePtr node = lookup(p);
+  if (!node && mode == FILE_WRITE)
+    node = create(p, false);
+  if (!node || (node->isDir && mode == FILE_WRITE))
+    return File();
+
+  HostOpenFile* of = new HostOpenFile;
+  of->node = node;
+  of->path = p;
+  of->pos = (mode == FILE_WRITE ? node->data.size() : 0);
+  of->mode = mode;
+  of->open = true;
+  of->refs = 0;
+  of->dirIndex = 0;
+  return File(of);
+}
+
+boolean SDClass::exists(const char* path)
+{
+  hostCharge(hostCosts.sdCall);
+  return lookup(normalise(path)) != NULL;
+}
+
+boolean SDClass::mkdir(const char* path)
+{
+  hostCharge(hostCosts.sdCall);
+  std::string p = normalise(path);
+  if (lookup(p))
+    return false;
+  std::string parent = parentOf(p);
+  if (!lookup(parent) && !mkdir(parent.c_str()))
+    return false;
+  return create(p, true) != NULL;
+}
+
+boolean SDClass::remove(const char* path)
+{
+  hostCharge(hostCosts.sdCall);
+  std::string p = normalise(path);
+  nodePtr node = lookup(p);
+  if (!node || node->isDir)
+    return false;
+  unlink(p);
+  return true;
+}
+
+boolean SDClass::rmdir(const char* path)
+{
+  hostCharge(hostCosts.sdCall);
+  std::string p = normalise(path);
+  nodePtr node = lookup(p);
+  if (!node || !node->isDir || node->children.size() || p == "/")
+    return false;
+  unlink(p);
+  return true;
+}
+
+// File. As with the SD library, copies share the same position.
+
+File::File(void) : _of(NULL)
+{
+}
+
+File::File(HostOpenFile* of) : _of(of)
+{
+  ++_of->refs;
+}
+
+File::File(const File& other) : Stream(), _of(other._of)
+{
+  if (_of)
+    ++_of->refs;
+}
+
+File& File::operator=(const File& other)
+{
+  if (other._of)
+    ++other._of->refs;
+  if (_of && --_of->refs == 0)
+    delete _of;
+  _of = other._of;
+  return *this;
+}
+
+File::~File()
+{
+  if (_of && --_of->refs == 0)
+    delete _of;
+}
+
+File::operator bool()
+{
+  return _of && _of->open;
+}
+
+size_t File::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size)
+{
+  hostCharge(hostCosts.sdCall);
+  if (!*this || _of->mode != FILE_WRITE)
+    return 0;
+  std::string& data = _of->node->data;
+  for (size_t done = 0; done < size; ) {
+    uint32_t block = _of->pos / BLOCK_SIZE;
+    size_t offset = _of->pos % BLOCK_SIZE;
+    size_t n = BLOCK_SIZE - offset;
+    if (n > size - done)
+      n = size - done;
+    useBlock(_of->node.get(), block, true, n == BLOCK_SIZE);
+    if (_of->pos + n > data.size())
+      data.resize(_of->pos + n);
+    data.replace(_of->pos, n, (const char*)buffer + done, n);
+    _of->pos += n;
+    done += n;
+  }
+  return size;
+}
+
+int File::read(void* buffer, uint16_t len)
+{
+  hostCharge(hostCosts.sdCall);
+  if (!*this || _of->node->isDir)
+    return -1;
+  const std::string& data = _of->node->data;
+  if (_of->pos >= data.size())
+    return 0;
+  if (len > data.size() - _of->pos)
+    len = data.size() - _of->pos;
+  for (uint32_t p = _of->pos; p < _of->pos + len;
+       p = (p / BLOCK_SIZE + 1) * BLOCK_SIZE)
+    useBlock(_of->node.get(), p / BLOCK_SIZE, false, false);
+  memcpy(buffer, data.data() + _of->pos, len);
+  _of->pos += len;
+  return len;
+}
+
+int File::read(void)
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek(void)
+{
+  int c = read();
+  if (c != -1)
+    --_of->pos;
+  return c;
+}
+
+int File::available(void)
+{
+  if (!*this || _of->node->isDir)
+    return 0;
+  uint32_t n = _of->node->data.size() - _of->pos;
+  return n > 0x7FFF ? 0x7FFF : n;
+}
+
+void File::flush(void)
+{
+  hostCharge(hostCosts.sdCall);
+  if (!*this || _of->mode != FILE_WRITE)
+    return;
+  writeBack();
+  // Update the directory entry
+  hostCharge(hostCosts.sdBlockRead + hostCosts.sdBlockWrite);
+  ++hostCounters.sdBlockReads;
+  ++hostCounters.sdBlockWrites;
+  cacheNode = NULL;
+  ++hostCounters.sdFlushes;
+}
+
+boolean File::seek(uint32_t pos)
+{
+  hostCharge(hostCosts.sdCall);
+  if (!*this || pos > _of->node->data.size())
+    return false;
+  _of->pos = pos;
+  return true;
+}
+
+uint32_t File::position(void)
+{
+  return _of ? _of->pos : 0;
+}
+
+uint32_t File::size(void)
+{
+  return _of ? _of->node->data.size() : 0;
+}
+
+void File::close(void)
+{
+  if (!*this)
+    return;
+  flush();
+  _of->open = false;
+}
+
+char* File::name(void)
+{
+  static char name[13];
+  name[0] = '\0';
+  if (_of)
+    strncat(name, _of->node->name.c_str(), 12);
+  return name;
+}
+
+boolean File::isDirectory(void)
+{
+  return *this && _of->node->isDir;
+}
+
+File File::openNextFile(uint8_t mode)
+{
+  if (!isDirectory())
+    return File();
+  node_t* dir = _of->node.get();
+  hostCharge(hostCosts.sdCall);
+  if (_of->dirIndex >= dir->children.size())
+    return File();
+  useBlock(dir, _of->dirIndex / (BLOCK_SIZE / DIR_ENTRY_SIZE), false, false);
+  hostCharge(hostCosts.sdDirEntry);
+  ++hostCounters.sdDirEntries;
+  const std::string& path = dir->children[_of->dirIndex++];
+
+  HostOpenFile* of = new HostOpenFile;
+  of->node = files[path];
+  of->path = path;
+  of->pos = 0;
+  of->mode = mode;
+  of->open = true;
+  of->refs = 0;
+  of->dirIndex = 0;
+  return File(of);
+}
+
+void File::rewindDirectory(void)
+{
+  if (isDirectory())
+    _of->dirIndex = 0;
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include "HostModel.h"
+#include "HostSite.h"
+
+void hostDefaultSite(hostSite_t& site)
+{
+  site.iniSections = 0;
+  site.dirEntries = 20;
+  site.depth = 4;
+  site.smallFiles = 5;
+  site.largeFileSize = 100000;
+}
+
+std::string hostDeepUrl(const hostSite_t& site)
+{
+  std::string url = "/deep";
+  for (unsigned i = 0; i < site.depth; ++i)
+    url += "/d" + std::to_string(i);
+  return url + "/leaf.txt";
+}
+
+void hostCreateSite(const hostSite_t& site)
+{
+  hostReset();
+
+  std::string ini = "; generated by HostSite.cpp\n"
+    "[mime types]\n"
+    "default = text/plain\n"
+    "htm = text/html\n"
+    "txt = text/plain\n"
+    "bin = application/octet-stream\n"
+    "csv = text/csv\n";
+  // Sections which every lookup must read past
+  for (unsigned i = 0; i < site.iniSections; ++i)
+    ini += "[/filler/" + std::to_string(i) + "]\n"
+      "; a section which no request uses\n"
+      "handler = default\n";
+  ini += "[/]\n"
+    "handler = default\n"
+    "error document 403 = /errordoc/403.htm\n"
+    "cache max age = 86400\n"
+    "[/www.ini]\n"
+    "handler = default\n"
+    "[/private]\n"
+    "handler = forbidden\n"
+    "[/status]\n"
+    "handler = status\n"
+    "priority = high\n"
+    "[/src]\n"
+    "handler = temporary redirect\n"
+    "location = http://github.com/stevemarple/WwwServer\n"
+    "[/live]\n"
+    "handler = include\n"
+    "[/logs]\n"
+    "handler = time range\n";
+  hostAddFile("/www.ini", ini);
+
+  hostAddFile("/index.htm", "<html><body>Hello</body></html>\n");
+  hostAddFile("/errordoc/403.htm", "<html><body>No</body></html>\n");
+  hostAddFile("/private/secret.txt", "secret\n");
+  hostAddFile("/live/page.htm", "<p>Now <!--#var time--></p>\n");
+  hostAddFile("/large.bin", site.largeFileSize);
+  for (unsigned i = 0; i < site.smallFiles; ++i)
+    hostAddFile(("/small/f" + std::to_string(i) + ".txt").c_str(),
+		100 + i * 900 / (site.smallFiles ? site.smallFiles : 1));
+  for (unsigned i = 0; i < site.dirEntries; ++i)
+    hostAddFile(("/big/file" + std::to_string(i) + ".txt").c_str(), 10);
+  hostAddFile(hostDeepUrl(site).c_str(), "at the bottom\n");
+
+  std::string csv;
+  for (int day = 1; day <= 28; ++day)
+    for (int hour = 0; hour < 24; ++hour) {
+      char line[40];
+      snprintf(line, sizeof(line), "2024-01-%02dT%02d:00:00Z,%d\n",
+	       day, hour, day * 100 + hour);
+      csv += line;
+    }
+  hostAddFile("/logs/temp.csv", csv);
+}
+
+std::string hostGetRequest(const std::string& url, const char* headers)
+{
+  return "GET " + url + " HTTP/1.1\r\n"
+    "Host: 192.168.1.10\r\n" + headers + "\r\n";
+}
+
+int hostStatusCode(const std::string& response)
+{
+  int code;
+  if (sscanf(response.c_str(), "HTTP/1.%*d %d", &code) == 1)
+    return code;
+  return 0;
+}
+
+std::string hostBody(const std::string& response)
+{
+  size_t i = response.find("\r\n\r\n");
+  return i == std::string::npos ? std::string() : response.substr(i + 4);
+}
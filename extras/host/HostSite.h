@@ -0,0 +1,32 @@
+#ifndef HOSTSITE_H
+#define HOSTSITE_H
+
+// A site on the simulated SD card, laid out like the example sketch's,
+// which can be made larger to find the worst cases.
+
+#include <string>
+
+typedef struct {
+  unsigned iniSections; // extra URL sections before the real ones
+  unsigned dirEntries; // extra files in /big
+  unsigned depth; // directories under /deep
+  unsigned smallFiles; // files of up to 1KB in /small
+  unsigned long largeFileSize; // size of /large.bin
+} hostSite_t;
+
+void hostDefaultSite(hostSite_t& site);
+void hostCreateSite(const hostSite_t& site);
+
+// URL of the file at the bottom of /deep
+std::string hostDeepUrl(const hostSite_t& site);
+
+// A complete GET request for url
+std::string hostGetRequest(const std::string& url,
+			   const char* headers = "");
+
+// Status code of a response, or 0 if there is none
+int hostStatusCode(const std::string& response);
+// Body of a response, without the headers
+std::string hostBody(const std::string& response);
+
+#endif
@@ -0,0 +1,184 @@
+// Request mixes run against the simulated hardware. For each mix
+// prints requests/s (from the time spent in processRequest(), so the
+// close delay and idle polling are excluded), calls to
+// processRequest() per request, and response bytes per call.
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <vector>
+#include "HostHarness.h"
+#include "HostSite.h"
+
+#define REQUESTS_PER_MIX 200
+
+typedef struct {
+  const char* name;
+  int expectedStatus;
+  std::string (*url)(unsigned n, const hostSite_t& site);
+} request_t;
+
+static std::string smallUrl(unsigned n, const hostSite_t& site)
+{
+  return "/small/f" + std::to_string(n % site.smallFiles) + ".txt";
+}
+
+static std::string largeUrl(unsigned n, const hostSite_t& site)
+{
+  return "/large.bin";
+}
+
+static std::string missingUrl(unsigned n, const hostSite_t& site)
+{
+  // A few repeat, as a browser asking for favicon.ico would
+  return "/missing/m" + std::to_string(n % 16) + ".htm";
+}
+
+static std::string listingUrl(unsigned n, const hostSite_t& site)
+{
+  return "/big/";
+}
+
+static std::string redirectUrl(unsigned n, const hostSite_t& site)
+{
+  // From the ini file, and to add a trailing slash
+  return (n % 2) ? "/src" : "/small";
+}
+
+static std::string deepUrl(unsigned n, const hostSite_t& site)
+{
+  return hostDeepUrl(site);
+}
+
+static const request_t smallFile = { "small", 200, smallUrl };
+static const request_t largeFile = { "large", 200, largeUrl };
+static const request_t missing = { "404", 404, missingUrl };
+static const request_t listing = { "listing", 200, listingUrl };
+static const request_t redirect = { "redirect", 0, redirectUrl };
+static const request_t deep = { "deep", 200, deepUrl };
+
+typedef struct {
+  const char* name;
+  std::vector<const request_t*> requests; // used in turn
+  size_t pieceLen; // request arrives in pieces of this size
+} mix_t;
+
+static double wallTime(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static boolean runMix(const mix_t& mix, const hostSite_t& site,
+		      boolean useCache)
+{
+  static char buffer[256];
+  static char cacheArena[4096];
+  hostCreateSite(site);
+  hostClearCounters();
+
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (useCache)
+    server.setFileCache(cacheArena, sizeof(cacheArena));
+  if (!server.begin(buffer, sizeof(buffer))) {
+    printf("%s: begin() failed\n", mix.name);
+    return false;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  server.resetStats();
+
+  double start = wallTime();
+  unsigned long bytes = 0;
+  for (unsigned n = 0; n < REQUESTS_PER_MIX; ++n) {
+    const request_t* rp = mix.requests[n % mix.requests.size()];
+    int id = hostConnect(80, hostGetRequest(rp->url(n, site)), 0xC0A80102UL,
+			 mix.pieceLen, mix.pieceLen ? 1000 : 0);
+    if (!harness.runUntilClosed(id)) {
+      printf("%s: request %u for %s not finished\n", mix.name, n,
+	     rp->url(n, site).c_str());
+      return false;
+    }
+    int status = hostStatusCode(hostResponse(id));
+    if (rp->expectedStatus ? status != rp->expectedStatus :
+	status / 100 != 3) {
+      printf("%s: request %u for %s got status %d\n", mix.name, n,
+	     rp->url(n, site).c_str(), status);
+      return false;
+    }
+    bytes += hostResponse(id).size();
+  }
+  double wall = wallTime() - start;
+
+  WwwServer::stats_t stats;
+  server.getStats(stats);
+  unsigned long calls = harness.getCalls();
+  if (stats.callCount != calls) {
+    printf("%s: server counted %lu calls, harness %lu\n", mix.name,
+	   stats.callCount, calls);
+    return false;
+  }
+  printf("%-22s %9.1f %9.1f %9.1f %9.0f %9.1f %9.1f\n",
+	 mix.name,
+	 REQUESTS_PER_MIX / (harness.getBusyTime() / 1e6),
+	 (double)calls / REQUESTS_PER_MIX,
+	 (double)bytes / calls,
+	 REQUESTS_PER_MIX / wall,
+	 (double)hostCounters.spiTransactions / REQUESTS_PER_MIX,
+	 (double)(hostCounters.sdBlockReads + hostCounters.sdBlockWrites)
+	 / REQUESTS_PER_MIX);
+  return true;
+}
+
+int main(void)
+{
+  hostDefaultCosts();
+  hostSetTime(0);
+
+  hostSite_t site;
+  hostDefaultSite(site);
+
+  std::vector<mix_t> mixes;
+  mix_t m;
+  m.pieceLen = 0;
+  m.name = "small files";
+  m.requests.assign(1, &smallFile);
+  mixes.push_back(m);
+  m.name = "large files";
+  m.requests.assign(1, &largeFile);
+  mixes.push_back(m);
+  m.name = "404s";
+  m.requests.assign(1, &missing);
+  mixes.push_back(m);
+  m.name = "directory listings";
+  m.requests.assign(1, &listing);
+  mixes.push_back(m);
+  m.name = "redirects";
+  m.requests.assign(1, &redirect);
+  mixes.push_back(m);
+  m.name = "deep URLs";
+  m.requests.assign(1, &deep);
+  mixes.push_back(m);
+  m.name = "mixed";
+  m.requests.clear();
+  for (int i = 0; i < 6; ++i)
+    m.requests.push_back(&smallFile);
+  m.requests.push_back(&missing);
+  m.requests.push_back(&redirect);
+  m.requests.push_back(&listing);
+  m.requests.push_back(&largeFile);
+  mixes.push_back(m);
+  m.name = "mixed, slow clients";
+  m.pieceLen = 8;
+  mixes.push_back(m);
+
+  boolean ok = true;
+  for (int cache = 0; cache < 2; ++cache) {
+    printf("\n%s\n", cache ? "With a 4KB file cache" : "No file cache");
+    printf("%-22s %9s %9s %9s %9s %9s %9s\n", "mix", "req/s", "calls/req",
+	   "bytes/call", "host req/s", "SPI/req", "blocks/req");
+    for (size_t i = 0; i < mixes.size(); ++i)
+      ok = runMix(mixes[i], site, cache) && ok;
+  }
+  return ok ? 0 : 1;
+}
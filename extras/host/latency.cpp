@@ -0,0 +1,777 @@
+// Regression suite for the work done by each call to processRequest().
+// Requests are run against sites of increasing size and against
+// adversarial clients, and the worst call seen in each state is
+// checked against the bounds below. Run with -v to print the worst
+// cases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+#include "HostHarness.h"
+#include "HostSite.h"
+
+#define BUFFER_LEN 256
+
+// Upper bounds for one call started in a state. Time excludes IniFile
+// lookups and directory searches, which are limited separately: a
+// call may make at most one lookup and open or check at most two
+// paths (the ini file and one other), whatever the size of the ini
+// file or the card.
+typedef struct {
+  int8_t state;
+  unsigned long ownTime; // us
+  unsigned long spi; // SPI transactions
+  unsigned long spiBytes;
+  unsigned long sdBlocks; // not counting lookups and searches
+} bound_t;
+
+#define MAX_INI_LOOKUPS 1
+#define MAX_SD_SEARCHES 2
+
+static const bound_t bounds[] = {
+  { WwwServer::stateNoClient, 1500, 20, 40, 2 },
+  { WwwServer::stateReadingMethod, 2500, 200, 200, 0 },
+  { WwwServer::stateGettingHandlerSetUp, 200, 4, 8, 0 },
+  { WwwServer::stateGettingHandler, 500, 4, 8, 0 },
+  { WwwServer::stateCheckingPostSetUp, 500, 4, 8, 0 },
+  { WwwServer::stateCheckingPost, 500, 4, 8, 0 },
+  { WwwServer::stateReadingHeaders, 2500, 200, 200, 0 },
+  { WwwServer::stateReceivingPost, 8000, 20, BUFFER_LEN + 64, 4 },
+  { WwwServer::stateUrlToFilename, 500, 4, 8, 1 },
+  { WwwServer::stateRedirectingToDirectory, 1500, 20, 300, 0 },
+  { WwwServer::stateFindingLocationSetUp, 200, 4, 8, 0 },
+  { WwwServer::stateFindingLocation, 500, 4, 8, 0 },
+  { WwwServer::stateFindingErrorDocumentSetUp, 500, 4, 8, 0 },
+  { WwwServer::stateFindingErrorDocument, 500, 4, 8, 0 },
+  { WwwServer::stateSendingStatusCode, 1500, 20, 150, 0 },
+  { WwwServer::stateRunningDefaultHandler, 2500, 40, 600, 2 },
+  { WwwServer::stateSendingFileMimeTypeSetUp, 200, 4, 8, 0 },
+  { WwwServer::stateSendingFileMimeType, 1500, 20, 150, 0 },
+  { WwwServer::stateSendingDefaultMimeTypeSetUp, 200, 4, 8, 0 },
+  { WwwServer::stateSendingDefaultMimeType, 1500, 20, 150, 0 },
+  { WwwServer::stateSendingFile, 3000, 20, BUFFER_LEN + 64, 2 },
+  { WwwServer::stateSendingCachedFile, 2000, 20, BUFFER_LEN + 150, 0 }, // + headers
+  { WwwServer::stateSendingDirectoryListingHeader, 2500, 40, 600, 0 },
+  { WwwServer::stateSendingDirectoryListingBody, 2500, 20, 150, 1 },
+  { WwwServer::stateSendingDirectoryListingFooter, 1500, 20, 150, 0 },
+  { WwwServer::stateRunningStatusHandler, 20000, 400, 3000, 0 },
+  { WwwServer::stateSubscribingEventStream, 1500, 20, 300, 0 },
+  { WwwServer::stateClosingConnection, 200, 4, 8, 0 },
+  { WwwServer::stateDisconnecting, 500, 10, 8, 0 },
+};
+
+// Extra work allowed in any call busy with a request when admission
+// control is on: checking for a waiting connection and reading its
+// request line, at most the same as reading a request line.
+static const bound_t admissionPoll = { -1, 2500, 200, 200, 0 };
+
+// Extra work allowed in any call busy with a request when the access
+// log buffer is nearly full: writing one sector.
+static const bound_t accessLogWrite = { -1, 2500, 0, 0, 1 };
+
+// Extra work allowed when a connection is refused with 429 Too Many
+// Requests as soon as it is accepted
+static const bound_t acceptRefusal = { WwwServer::stateNoClient, 1000, 20,
+				       120, 0 };
+
+static boolean verbose = false;
+static int failures = 0;
+static char buffer[BUFFER_LEN];
+
+static void fail(const char* scenario, const char* what)
+{
+  printf("FAIL %s: %s\n", scenario, what);
+  ++failures;
+}
+
+static void check(boolean ok, const char* scenario, const char* what)
+{
+  if (!ok)
+    fail(scenario, what);
+}
+
+static void checkBounds(const char* scenario, const HostHarness& harness,
+			const bound_t* extra = NULL)
+{
+  if (verbose)
+    printf("\n%s\n%-30s %6s %6s %6s %5s %6s %6s %7s %6s %7s\n", scenario,
+	   "state", "calls", "time", "own", "SPI", "bytes", "blocks",
+	   "lookups", "lines", "paths");
+  for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); ++i) {
+    bound_t b = bounds[i];
+    // Extra work for a state, or for any busy state if state is -1
+    if (extra && (extra->state == b.state ||
+		  (extra->state == -1 && b.state != WwwServer::stateNoClient))) {
+      b.ownTime += extra->ownTime;
+      b.spi += extra->spi;
+      b.spiBytes += extra->spiBytes;
+      b.sdBlocks += extra->sdBlocks;
+    }
+    const hostStateStats_t& s = harness.getStateStats(b.state);
+    if (s.calls == 0)
+      continue;
+    if (verbose)
+      printf("%-30s %6lu %6lu %6lu %5lu %6lu %6lu %7lu %6lu %7lu\n",
+	     HostHarness::stateName(b.state), s.calls, s.timeWorstCase,
+	     s.ownTimeWorstCase, s.spiWorstCase, s.spiBytesWorstCase,
+	     s.sdOwnBlocksWorstCase, s.iniLookupsWorstCase,
+	     s.iniLinesWorstCase, s.sdSearchesWorstCase);
+    char what[120];
+    snprintf(what, sizeof(what), "%s: time %lu, SPI %lu/%lu bytes, "
+	     "blocks %lu, lookups %lu, paths %lu",
+	     HostHarness::stateName(b.state), s.ownTimeWorstCase,
+	     s.spiWorstCase, s.spiBytesWorstCase, s.sdOwnBlocksWorstCase,
+	     s.iniLookupsWorstCase, s.sdSearchesWorstCase);
+    check(s.ownTimeWorstCase <= b.ownTime && s.spiWorstCase <= b.spi &&
+	  s.spiBytesWorstCase <= b.spiBytes &&
+	  s.sdOwnBlocksWorstCase <= b.sdBlocks &&
+	  s.iniLookupsWorstCase <= MAX_INI_LOOKUPS &&
+	  s.sdSearchesWorstCase <= MAX_SD_SEARCHES, scenario, what);
+  }
+}
+
+typedef struct {
+  std::string request;
+  int status; // expected, 0 for none (connection dropped)
+  size_t pieceLen;
+  unsigned long interval;
+} request_t;
+
+static request_t get(const std::string& url, int status)
+{
+  request_t r = { hostGetRequest(url), status, 0, 0 };
+  return r;
+}
+
+static request_t raw(const std::string& request, int status,
+		     size_t pieceLen = 0, unsigned long interval = 0)
+{
+  request_t r = { request, status, pieceLen, interval };
+  return r;
+}
+
+// Send each request in turn, checking the status of each response
+static void runRequests(const char* scenario, WwwServer& server,
+			HostHarness& harness,
+			const std::vector<request_t>& requests)
+{
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const request_t& r = requests[i];
+    int id = hostConnect(80, r.request, 0xC0A80102UL, r.pieceLen,
+			 r.interval);
+    char what[120];
+    snprintf(what, sizeof(what), "request %u not finished",
+	     (unsigned)i);
+    if (!harness.runUntilClosed(id, 200000000UL)) {
+      fail(scenario, what);
+      continue;
+    }
+    int status = hostStatusCode(hostResponse(id));
+    snprintf(what, sizeof(what), "request %u: status %d, expected %d",
+	     (unsigned)i, status, r.status);
+    check(status == r.status, scenario, what);
+  }
+}
+
+// Requests using each handler, which every site must answer
+static void addHandlerRequests(std::vector<request_t>& requests,
+			       const hostSite_t& site)
+{
+  requests.push_back(get("/index.htm", 200));
+  requests.push_back(get("/small/f1.txt", 200));
+  requests.push_back(get("/large.bin", 200));
+  requests.push_back(get("/missing.htm", 404));
+  requests.push_back(get("/missing.htm", 404)); // now known missing
+  requests.push_back(get("/private/secret.txt", 403));
+  requests.push_back(get("/src", 307));
+  requests.push_back(get("/small", 301));
+  requests.push_back(get("/big/", 200));
+  requests.push_back(get("/status", 200));
+  requests.push_back(get("/live/page.htm", 200));
+  requests.push_back(get("/logs/temp.csv?from=2024-01-02&to=2024-01-03",
+			 200));
+  requests.push_back(get(hostDeepUrl(site), 200));
+}
+
+static void printTime(Print& out)
+{
+  out.print(hostTime() / 1000000UL);
+}
+
+// Run the handler requests against a site, checking the bounds
+static void runSite(const char* scenario, const hostSite_t& site)
+{
+  hostCreateSite(site);
+  hostClearCounters();
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  static char query[64];
+  server.setQueryBuffer(query, sizeof(query));
+  server.addIncludeVariable("time", printTime);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  std::vector<request_t> requests;
+  addHandlerRequests(requests, site);
+  runRequests(scenario, server, harness, requests);
+  // An idle server can be left until it next checks for connections
+  harness.step();
+  check(server.getWakeDelay() > 0 &&
+	server.getWakeDelay() <= WWW_SERVER_IDLE_POLL_INTERVAL, scenario,
+	"no wake delay when idle");
+  checkBounds(scenario, harness);
+}
+
+// Clients which send too much, too little or too slowly
+static void runAdversarial(void)
+{
+  const char* scenario = "adversarial requests";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  // An error document for ?follow of a missing file
+  std::string ini = hostReadFile("/www.ini");
+  ini.insert(ini.find("[/]\n") + 4,
+	     "error document 404 = /errordoc/404.htm\n");
+  hostAddFile("/www.ini", ini);
+  hostAddFile("/errordoc/404.htm", "<html><body>Missing</body></html>\n");
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+
+  std::string longHeader = "X-Filler: " + std::string(3000, 'a') + "\r\n";
+  std::vector<request_t> requests;
+  // A byte at a time, with a header much longer than any buffer
+  requests.push_back(raw(hostGetRequest("/index.htm", longHeader.c_str()),
+			 200, 1, 100));
+  // CR and LF arriving in different pieces
+  requests.push_back(raw("GET /index.htm HTTP/1.1\r\nA: b\r\n\r\n", 200,
+			 25, 300000));
+  requests.push_back(raw("GET /index.htm HTTP/1.1\r\n\r\n", 200, 24,
+			 300000));
+  requests.push_back(raw("\r\n\r\nGET /index.htm HTTP/1.0\n\n", 200));
+  requests.push_back(get("/" + std::string(200, 'u'), 414));
+  requests.push_back(get("/index.htm?" + std::string(200, 'q'), 414));
+  requests.push_back(get("/a/%00b", 400));
+  requests.push_back(get("/a/%0d%0aSet-Cookie:x", 400));
+  requests.push_back(get("/a/%7f", 400));
+  requests.push_back(get("/a/\x01b", 400));
+  requests.push_back(get("/caf%C3%A9.htm", 404)); // UTF-8 is allowed
+  requests.push_back(get("/../www.ini", 400));
+  requests.push_back(get("/%2e%2e/www.ini", 400));
+  requests.push_back(raw("DESTROY / HTTP/1.1\r\n\r\n", 400));
+  requests.push_back(raw(std::string(500, '\xff') + "\r\n\r\n", 400));
+  requests.push_back(raw("GET", 408)); // then nothing until the deadline
+  requests.push_back(raw("GET /index.htm HTTP/1.1\r\nA: b\r\n", 408));
+  runRequests(scenario, server, harness, requests);
+
+  // An error document is sent whole, not followed as the file grows
+  int id = hostConnect(80, hostGetRequest("/missing.htm?follow"));
+  check(harness.runUntilClosed(id, 5000000UL) &&
+	hostStatusCode(hostResponse(id)) == 404 &&
+	hostResponse(id).find("Missing") != std::string::npos &&
+	hostResponse(id).find("408") == std::string::npos, scenario,
+	"error document followed");
+
+  // A client which stops reading part way through a download is
+  // dropped by the TX timeout without holding up any call
+  id = hostConnect(80, hostGetRequest("/large.bin"));
+  harness.runFor(30000);
+  hostSetClientStalled(id, true);
+  check(harness.runUntilClosed(id, 30000000UL), scenario,
+	"stalled client not dropped");
+  check(hostResponse(id).size() < 60000, scenario,
+	"stalled client sent the whole file");
+
+  // A client which goes away mid request
+  id = hostConnect(80, "GET /index.htm HTTP/1.1\r\nHost: x\r\n");
+  hostClientClose(id);
+  check(harness.runUntilClosed(id, 30000000UL), scenario,
+	"closed client not dropped");
+  checkBounds(scenario, harness);
+}
+
+// Connections arriving whilst the server is busy wait in the queue
+// until their request line is complete, or are started with the rest
+// of the line still to come. Queries longer than a queue entry are
+// read once the request starts.
+static void runAdmission(void)
+{
+  const char* scenario = "admission queue";
+  hostSite_t site;
+  hostDefaultSite(site);
+  site.largeFileSize = 2000000UL;
+  hostCreateSite(site);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  static char query[64];
+  server.setQueryBuffer(query, sizeof(query));
+  server.setAdmissionPolicy(3, 1);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  std::string slow = hostGetRequest("/small/f1.txt?" + std::string(40, 'q'));
+  std::string small = hostReadFile("/small/f1.txt");
+
+  // Queued whilst a large file is sent
+  int busy = hostConnect(80, hostGetRequest("/large.bin"));
+  harness.runFor(50000);
+  int queued = hostConnect(80, slow, 0xC0A80103UL, 5, 20000);
+  harness.runFor(100000);
+  int refused = hostConnect(80, hostGetRequest("/index.htm"), 0xC0A80104UL);
+  check(harness.runUntilClosed(refused) &&
+	hostStatusCode(hostResponse(refused)) == 503, scenario,
+	"no 503 with the queue full");
+  check(harness.runUntilClosed(queued) &&
+	hostStatusCode(hostResponse(queued)) == 200 &&
+	hostBody(hostResponse(queued)) == small, scenario,
+	"queued request failed");
+  check(harness.runUntilClosed(busy) &&
+	hostStatusCode(hostResponse(busy)) == 200, scenario,
+	"large file failed");
+
+  // Taken from the queue before the request line is complete
+  busy = hostConnect(80, hostGetRequest("/small/f2.txt"), 0xC0A80102UL,
+		     10, 20000);
+  harness.runFor(1000);
+  queued = hostConnect(80, slow, 0xC0A80103UL, 5, 20000);
+  check(harness.runUntilClosed(busy) && harness.runUntilClosed(queued) &&
+	hostStatusCode(hostResponse(queued)) == 200 &&
+	hostBody(hostResponse(queued)) == small, scenario,
+	"partly queued request failed");
+  checkBounds(scenario, harness, &admissionPoll);
+}
+
+// The access log is written a whole sector at a time, stays on sector
+// boundaries after a forced write, and is flushed rarely
+static void runAccessLog(void)
+{
+  const char* scenario = "access log";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  static char logBuffer[1024];
+  if (!server.begin(buffer, sizeof(buffer)) ||
+      !server.setAccessLog(logBuffer, sizeof(logBuffer), "/log1.txt",
+			   "/log2.txt", 1000000UL)) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  std::vector<request_t> requests;
+  for (int i = 0; i < 5; ++i)
+    requests.push_back(get("/index.htm", 200));
+  runRequests(scenario, server, harness, requests);
+  server.flushAccessLog();
+  check(hostReadFile("/log1.txt").size() % 512 != 0, scenario,
+	"forced write was a whole sector");
+
+  for (int i = 0; i < 40; ++i)
+    requests.push_back(get("/index.htm", 200));
+  hostClearCounters();
+  runRequests(scenario, server, harness, requests);
+  char what[120];
+  snprintf(what, sizeof(what), "%lu bytes written, %lu flushes",
+	   (unsigned long)hostReadFile("/log1.txt").size(),
+	   hostCounters.sdFlushes);
+  check(hostReadFile("/log1.txt").size() % 512 == 0 &&
+	hostReadFile("/log1.txt").size() >= 2048 &&
+	hostCounters.sdFlushes <= 1, scenario, what);
+
+  server.flushAccessLog();
+  std::string log = hostReadFile("/log1.txt");
+  snprintf(what, sizeof(what), "%d entries logged, expected 50",
+	   (int)std::count(log.begin(), log.end(), '\n'));
+  check(std::count(log.begin(), log.end(), '\n') == 50, scenario, what);
+
+  // The duration, last on each line, excludes the close delay
+  unsigned long longest = 0;
+  for (size_t end = log.find('\n'); end != std::string::npos;
+       end = log.find('\n', end + 1)) {
+    size_t start = log.rfind(' ', end) + 1;
+    unsigned long us = strtoul(log.c_str() + start, NULL, 10);
+    if (us > longest)
+      longest = us;
+  }
+  snprintf(what, sizeof(what), "longest logged duration %lu us", longest);
+  check(longest > 0 && longest < WWW_SERVER_CLOSE_DELAY / 4, scenario, what);
+  checkBounds(scenario, harness, &accessLogWrite);
+}
+
+// A section's rate limit only applies to its own URLs, and the limit
+// set by setRateLimit() to every connection. Requests refused by a
+// host rule are not charged.
+static void runRateLimits(void)
+{
+  const char* scenario = "rate limits";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  hostAddFile("/www.ini",
+	      "[/]\n"
+	      "handler = default\n"
+	      "[/small]\n"
+	      "rate limit = 1\n"
+	      "rate limit burst = 2\n"
+	      "[/small/denied]\n"
+	      "hosts deny = 192.168.1.2\n");
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  server.setRateLimit(1, 7); // every connection, refused or not
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  std::vector<request_t> requests;
+  requests.push_back(get("/small/denied/f1.txt", 403));
+  requests.push_back(get("/small/denied/f1.txt", 403));
+  requests.push_back(get("/small/f1.txt", 200));
+  requests.push_back(get("/small/f1.txt", 200));
+  requests.push_back(get("/small/f1.txt", 429)); // limit for /small
+  requests.push_back(get("/index.htm", 200));
+  requests.push_back(get("/index.htm", 200));
+  requests.push_back(get("/index.htm", 429)); // limit for any URL
+  runRequests(scenario, server, harness, requests);
+  checkBounds(scenario, harness, &acceptRefusal);
+}
+
+// A cached file changed on the card by other code is not served from
+// the cache once fileModified() is called, or once its size differs
+// if WWW_FILE_CACHE_CHECK_SIZE is set
+static void runFileCache(void)
+{
+  const char* scenario = "file cache";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  static char cacheArena[4096];
+  server.setFileCache(cacheArena, sizeof(cacheArena));
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  for (int i = 0; i < 3; ++i) {
+    if (i == 2) {
+      hostAddFile("/small/f1.txt", "changed\n");
+#if WWW_FILE_CACHE_CHECK_SIZE == 0
+      server.fileModified("/small/f1.txt");
+#endif
+    }
+    int id = hostConnect(80, hostGetRequest("/small/f1.txt"));
+    check(harness.runUntilClosed(id) &&
+	  hostBody(hostResponse(id)) == hostReadFile("/small/f1.txt"),
+	  scenario, i == 2 ? "changed file served from the cache" :
+	  "wrong contents");
+  }
+  checkBounds(scenario, harness);
+}
+
+// A section whose cache control has no known directive sends no
+// Cache-Control header, and does not take max-age from above
+static void runCacheHeaders(void)
+{
+  const char* scenario = "cache headers";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  std::string ini = hostReadFile("/www.ini");
+  ini += "[/small]\n"
+    "cache control = bogus, no-such-thing\n";
+  hostAddFile("/www.ini", ini);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  int id = hostConnect(80, hostGetRequest("/index.htm"));
+  check(harness.runUntilClosed(id) &&
+	hostResponse(id).find("Cache-Control: max-age=86400\r\n") !=
+	std::string::npos, scenario, "no max-age from /");
+  id = hostConnect(80, hostGetRequest("/small/f1.txt"));
+  check(harness.runUntilClosed(id) &&
+	hostStatusCode(hostResponse(id)) == 200 &&
+	hostResponse(id).find("Cache-Control") == std::string::npos,
+	scenario, "Cache-Control sent without a directive");
+  checkBounds(scenario, harness);
+}
+
+static void printValue(Print& out)
+{
+  out.print(std::string(WWW_INCLUDE_MAX_VALUE_LEN, 'v').c_str());
+}
+
+// Join the chunks of a chunked body, empty if it is not complete
+static std::string hostDechunk(const std::string& body)
+{
+  std::string data;
+  size_t i = 0;
+  for (;;) {
+    char* end;
+    unsigned long n = strtoul(body.c_str() + i, &end, 16);
+    i = end - body.c_str() + 2;
+    if (n == 0)
+      return body.compare(i, std::string::npos, "\r\n") == 0 ?
+	data : std::string();
+    if (i + n + 2 > body.size())
+      return std::string();
+    data += body.substr(i, n);
+    i += n + 2;
+  }
+}
+
+// Values which make a template much longer are sent no faster than a
+// slow client takes them, without blocking on a full TX buffer
+static void runInclude(void)
+{
+  const char* scenario = "include";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  std::string page, expected;
+  for (int i = 0; i < 30; ++i) {
+    page += "<!--#var value--> ";
+    expected += std::string(WWW_INCLUDE_MAX_VALUE_LEN, 'v') + " ";
+  }
+  hostAddFile("/live/page.htm", page);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  server.addIncludeVariable("value", printValue);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  unsigned long clientBytesPerMs = hostCosts.clientBytesPerMs;
+  hostCosts.clientBytesPerMs = 20;
+  int id = hostConnect(80, hostGetRequest("/live/page.htm"));
+  check(harness.runUntilClosed(id, 30000000UL) &&
+	hostDechunk(hostBody(hostResponse(id))) == expected, scenario,
+	"wrong contents");
+  hostCosts.clientBytesPerMs = clientBytesPerMs;
+  checkBounds(scenario, harness);
+}
+
+// The top URL table charges each URL its service time without the
+// close delay, and the status page shows client URLs as text
+static void runTopUrls(void)
+{
+  const char* scenario = "top URLs";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  std::vector<request_t> requests;
+  for (int i = 0; i < 3; ++i)
+    requests.push_back(get("/index.htm", 200));
+  requests.push_back(get("/<b>x&y\".htm", 404));
+  runRequests(scenario, server, harness, requests);
+
+  const WwwTopUrls::entry_t *ep;
+  for (uint8_t i = 0; (ep = server.getTopUrls().getEntry(i)) != NULL; ++i) {
+    char what[120];
+    snprintf(what, sizeof(what), "%.40s: %lu ms for %lu requests",
+	     ep->name, ep->time, (unsigned long)ep->requests);
+    check(ep->time < ep->requests * (WWW_SERVER_CLOSE_DELAY / 4000),
+	  scenario, what);
+  }
+
+  int id = hostConnect(80, hostGetRequest("/status"));
+  check(harness.runUntilClosed(id), scenario, "status not finished");
+  std::string body = hostBody(hostResponse(id));
+  check(body.find("<b>") == std::string::npos &&
+	body.find("/&lt;b&gt;x&amp;y&quot;.htm") != std::string::npos,
+	scenario, "URL not escaped on the status page");
+  checkBounds(scenario, harness);
+}
+
+// Host rules of parent directories still apply in their subsections.
+// Denied requests are answered without reading the ini file.
+static void runHostRules(void)
+{
+  const char* scenario = "host rules";
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  hostAddFile("/www.ini",
+	      "[/]\n"
+	      "handler = default\n"
+	      "hosts deny = 10.0.0.0/8\n"
+	      "[/status]\n"
+	      "handler = status\n"
+	      "hosts allow = 10.1.0.0/16, 192.168.1.0/24\n"
+	      "[/small]\n"
+	      "hosts allow = 192.168.1.0/24\n"
+	      "[/small/f1.txt]\n"
+	      "hosts deny = 192.168.1.3\n");
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+
+  static const struct {
+    const char* url;
+    uint32_t address;
+    int status; // 0 if dropped
+  } requests[] = {
+    { "/status", 0xC0A80102UL, 200 },
+    { "/status", 0x0A010005UL, 0 }, // / denies, whatever /status allows
+    { "/small/f1.txt", 0xC0A80102UL, 200 },
+    { "/small/f1.txt", 0xC0A80103UL, 403 },
+    { "/small/f1.txt", 0xAC100001UL, 403 }, // not in the /small list
+    { "/index.htm", 0xAC100001UL, 200 },
+  };
+  for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); ++i) {
+    int id = hostConnect(80, hostGetRequest(requests[i].url),
+			 requests[i].address);
+    char what[120];
+    snprintf(what, sizeof(what), "%s from %08lx not finished",
+	     requests[i].url, (unsigned long)requests[i].address);
+    if (!harness.runUntilClosed(id, 30000000UL)) {
+      fail(scenario, what);
+      continue;
+    }
+    int status = hostStatusCode(hostResponse(id));
+    snprintf(what, sizeof(what), "%s from %08lx: status %d, expected %d",
+	     requests[i].url, (unsigned long)requests[i].address, status,
+	     requests[i].status);
+    check(status == requests[i].status, scenario, what);
+  }
+  checkBounds(scenario, harness);
+}
+
+// Run requests across the rollover of micros() and millis(). The
+// request time and slowest call must be sane, and the close delay
+// must neither end at once nor last until the next rollover.
+static void runRollover(uint32_t us, uint32_t ms,
+			const char* scenario)
+{
+  hostSite_t site;
+  hostDefaultSite(site);
+  hostCreateSite(site);
+  WwwServerConfig config("/www.ini");
+  WwwServer server(config);
+  if (!server.begin(buffer, sizeof(buffer))) {
+    fail(scenario, "begin() failed");
+    return;
+  }
+  HostHarness harness(server, buffer, sizeof(buffer));
+  server.setStatsWindow(1000);
+  hostSetClocks(us, ms);
+  server.resetStats();
+
+  for (int i = 0; i < 5; ++i) {
+    int id = hostConnect(80, hostGetRequest("/small/f1.txt"));
+    // Find when the last of the response was written
+    uint64_t sent = 0;
+    size_t len = 0;
+    uint64_t end = hostTime() + 10000000UL;
+    while (!hostIsClosed(id) && hostTime() < end) {
+      harness.step();
+      if (hostResponse(id).size() != len) {
+	len = hostResponse(id).size();
+	sent = hostTime();
+      }
+      hostAdvance(1000);
+    }
+    char what[120];
+    snprintf(what, sizeof(what), "request %d: status %d", i,
+	     hostStatusCode(hostResponse(id)));
+    check(hostIsClosed(id) && hostStatusCode(hostResponse(id)) == 200,
+	  scenario, what);
+    unsigned long closeDelay = hostTime() - sent;
+    snprintf(what, sizeof(what), "request %d: closed after %lu us", i,
+	     closeDelay);
+    check(closeDelay >= WWW_SERVER_CLOSE_DELAY &&
+	  closeDelay < WWW_SERVER_CLOSE_DELAY + 500000UL, scenario, what);
+  }
+
+  WwwServer::stats_t stats;
+  server.getStats(stats);
+  char what[120];
+  snprintf(what, sizeof(what), "requests %lu, request time %lu us, "
+	   "task time %lu us", stats.requestCount,
+	   stats.requestTimeWorstCase, stats.taskTimeWorstCase);
+  check(stats.requestCount == 5 &&
+	stats.requestTimeWorstCase < WWW_SERVER_CLOSE_DELAY + 1000000UL &&
+	stats.taskTimeWorstCase < 100000UL, scenario, what);
+  if (verbose)
+    printf("\n%s: %s\n", scenario, what);
+  server.getStats(stats, WwwServer::statsCurrentWindow);
+  check(stats.taskTimeWorstCase < 100000UL, scenario,
+	"task time in the current window");
+}
+
+int main(int argc, char* argv[])
+{
+  verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+  hostDefaultCosts();
+  hostSetTime(0);
+
+  hostSite_t site;
+  hostDefaultSite(site);
+  runSite("default site", site);
+
+  hostSite_t big = site;
+  big.iniSections = 200;
+  runSite("large ini file", big);
+
+  big = site;
+  big.depth = 16;
+  runSite("deep URLs", big);
+
+  big = site;
+  big.dirEntries = 500;
+  runSite("big directory", big);
+
+  big = site;
+  big.largeFileSize = 2000000UL;
+  runSite("large file", big);
+
+  runAdversarial();
+  runHostRules();
+  runRateLimits();
+  runAdmission();
+  runAccessLog();
+  runFileCache();
+  runCacheHeaders();
+  runInclude();
+  runTopUrls();
+
+  runRollover(UINT32_MAX - 1000000UL, 1000, "micros() rollover");
+  runRollover(1000, UINT32_MAX - 1000UL, "millis() rollover");
+  runRollover(UINT32_MAX - 1000000UL, UINT32_MAX - 1000UL,
+	      "micros() and millis() rollover");
+
+  if (failures)
+    printf("%d failures\n", failures);
+  else
+    printf("All latency checks passed\n");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// Host stand-in for the parts of the Arduino core used by the
+// library. Time comes from the virtual clock in HostModel.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+
+// 32 bits wide, as on the AVR, whatever the width of unsigned long
+uint32_t micros(void);
+uint32_t millis(void);
+void delay(unsigned long ms);
+void noInterrupts(void);
+void interrupts(void);
+
+class Printable;
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const char* buffer, size_t size) {
+    return write((const uint8_t*)buffer, size);
+  }
+  virtual int availableForWrite(void) { return 0; }
+
+  size_t print(const char s[]);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(const Printable& p);
+
+  size_t println(const char s[]);
+  size_t println(char c);
+  size_t println(unsigned char n, int base = DEC);
+  size_t println(int n, int base = DEC);
+  size_t println(unsigned int n, int base = DEC);
+  size_t println(long n, int base = DEC);
+  size_t println(unsigned long n, int base = DEC);
+  size_t println(const Printable& p);
+  size_t println(void);
+
+private:
+  size_t printNumber(unsigned long n, int base);
+};
+
+class Printable
+{
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual int peek(void) = 0;
+  virtual void flush(void) = 0;
+};
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud);
+  virtual size_t write(uint8_t c);
+  using Print::write;
+  virtual int available(void);
+  virtual int read(void);
+  virtual int peek(void);
+  virtual void flush(void);
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress : public Printable
+{
+public:
+  IPAddress(void);
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+  IPAddress(uint32_t address);
+  operator uint32_t() const;
+  uint8_t operator[](int index) const;
+  bool operator==(const IPAddress& other) const;
+  virtual size_t printTo(Print& p) const;
+
+private:
+  uint8_t _address[4];
+};
+
+#endif
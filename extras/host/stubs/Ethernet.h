@@ -0,0 +1,64 @@
+#ifndef ETHERNET_H
+#define ETHERNET_H
+
+// Host stand-in for the Arduino Ethernet library. Sockets are
+// simulated by HostEthernet.cpp; each call is charged to the virtual
+// clock as an SPI transaction.
+
+#include <Arduino.h>
+
+#define MAX_SOCK_NUM 8
+
+class EthernetClient : public Stream
+{
+public:
+  EthernetClient(void);
+  EthernetClient(uint8_t sock);
+
+  uint8_t status(void);
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  virtual int availableForWrite(void);
+  virtual int available(void);
+  virtual int read(void);
+  int read(uint8_t* buffer, size_t size);
+  virtual int peek(void);
+  virtual void flush(void);
+  void stop(void);
+  uint8_t connected(void);
+  operator bool();
+  bool operator==(const EthernetClient& other) const;
+  bool operator!=(const EthernetClient& other) const {
+    return !(*this == other);
+  }
+  IPAddress remoteIP(void);
+  uint8_t getSocketNumber(void) const;
+
+private:
+  uint8_t _sock;
+};
+
+class EthernetServer : public Print
+{
+public:
+  EthernetServer(uint16_t port);
+  EthernetClient available(void);
+  void begin(void);
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+
+private:
+  uint16_t _port;
+};
+
+class EthernetClass
+{
+public:
+  IPAddress localIP(void);
+};
+
+extern EthernetClass Ethernet;
+
+#endif
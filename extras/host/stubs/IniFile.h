@@ -0,0 +1,42 @@
+#ifndef INIFILE_H
+#define INIFILE_H
+
+// Host stand-in for the IniFile library. Lookups read the file from
+// the simulated SD card a line at a time, so they are charged like
+// the real library.
+
+#include <SD.h>
+
+class IniFileState
+{
+public:
+  IniFileState(void);
+};
+
+class IniFile
+{
+public:
+  enum {
+    errorBufferTooShort = -1,
+    errorFileNotOpen = -2,
+    errorSectionNotFound = -10,
+    errorKeyNotFound = -11,
+  };
+
+  IniFile(const char* filename, uint8_t mode = FILE_READ);
+  boolean open(void);
+  void close(void);
+  boolean validate(char* buffer, int len);
+  // Returns 1 if found, otherwise one of the errors above
+  int8_t getValue(const char* section, const char* key, char* buffer,
+		  int len);
+
+private:
+  int readLine(char* buffer, int len);
+
+  const char* _filename;
+  uint8_t _mode;
+  File _file;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SD_H
+#define SD_H
+
+// Host stand-in for the Arduino SD library. Files are held in memory
+// by HostSD.cpp, which charges the virtual clock for directory
+// searches and block transfers.
+
+#include <Arduino.h>
+
+#define FILE_READ 0x01
+#define FILE_WRITE 0x13
+
+class HostOpenFile;
+
+class File : public Stream
+{
+public:
+  File(void);
+  File(HostOpenFile* of);
+  File(const File& other);
+  File& operator=(const File& other);
+  ~File();
+
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+  virtual int read(void);
+  virtual int peek(void);
+  virtual int available(void);
+  virtual void flush(void);
+  int read(void* buffer, uint16_t len);
+  boolean seek(uint32_t pos);
+  uint32_t position(void);
+  uint32_t size(void);
+  void close(void);
+  operator bool();
+  char* name(void);
+  boolean isDirectory(void);
+  File openNextFile(uint8_t mode = FILE_READ);
+  void rewindDirectory(void);
+
+private:
+  HostOpenFile* _of;
+};
+
+class SDClass
+{
+public:
+  boolean begin(uint8_t csPin = 4);
+  File open(const char* filename, uint8_t mode = FILE_READ);
+  boolean exists(const char* path);
+  boolean mkdir(const char* path);
+  boolean remove(const char* path);
+  boolean rmdir(const char* path);
+};
+
+extern SDClass SD;
+
+#endif